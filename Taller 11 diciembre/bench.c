@@ -0,0 +1,686 @@
+/*
+ * Benchmarks del Sistema Logístico.
+ * Enlaza el núcleo de final.c sin su menú y ejecuta cargas sintéticas con semilla fija.
+ * Cada fase reporta ns/op, operaciones por segundo, altura del árbol y RSS pico;
+ * --csv agrega filas a un archivo (para seguir regresiones) y --json escribe la corrida.
+ *
+ * Compilar: gcc -O2 bench.c -o bench.exe
+ *           (carga intake: gcc -O2 -DCONCURRENT_INTAKE -pthread bench.c -o bench.exe)
+ * Ejecutar: ./bench.exe [lotes] [operaciones] [semilla] [--csv f] [--json f] [carga...]
+ * Cargas: seq random skewed longq alloc delete index intake dispatch expiry (por defecto todas)
+ */
+
+#define FINAL_NO_MAIN
+#include "final.c"
+
+#include <time.h>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+// Small deterministic generator so runs are reproducible
+unsigned long long bench_rng_state = 88172645463325252ULL;
+
+unsigned long long bench_rand(void) {
+    unsigned long long x = bench_rng_state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return bench_rng_state = x;
+}
+
+double now_seconds(void) {
+    return (double)stats_now_ns() * 1e-9;
+}
+
+int random_date(void) {
+    int y = 2000 + (int)(bench_rand() % 1000);
+    int m = 1 + (int)(bench_rand() % 12);
+    int d = 1 + (int)(bench_rand() % 28);
+    return y * 10000 + m * 100 + d;
+}
+
+// Valid calendar date for the i-th lot of a sequence (28-day months)
+int date_from_index(long i) {
+    return (int)(2000 + i / 336) * 10000 + (int)(1 + (i / 28) % 12) * 100 + (int)(1 + i % 28);
+}
+
+const char *bench_destinations[] = {"Cali", "Bogota", "Medellin", "Tumaco", "Guapi", "Buenaventura"};
+#define BENCH_DEST_COUNT 6
+
+// Peak resident set size in KB (0 where getrusage is unavailable)
+long peak_rss_kb(void) {
+#ifdef _WIN32
+    return 0;
+#else
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+#ifdef __APPLE__
+    return ru.ru_maxrss / 1024; // bytes on macOS
+#else
+    return ru.ru_maxrss;
+#endif
+#endif
+}
+
+// ---------------------------------------------------------------------------
+// Resultados: una fila por fase medida
+// ---------------------------------------------------------------------------
+
+typedef struct BenchResult {
+    char workload[16];
+    char op[24];
+    long count;
+    double seconds;
+    int height;
+    int lots;
+    long rss_kb;
+} BenchResult;
+
+#define BENCH_MAX_RESULTS 128
+BenchResult bench_results[BENCH_MAX_RESULTS];
+int bench_result_count = 0;
+
+void bench_record(const char *workload, const char *op, long count, double seconds, int height, int lots) {
+    double ns = count ? seconds * 1e9 / count : 0.0;
+    double per_sec = seconds > 0 ? count / seconds : 0.0;
+    long rss = peak_rss_kb();
+    printf("%-8s %-12s %10ld ops %10.1f ns/op %12.0f ops/s  altura %2d  lotes %8d  rss %ld KB\n",
+           workload, op, count, ns, per_sec, height, lots, rss);
+    if (bench_result_count == BENCH_MAX_RESULTS) return;
+    BenchResult *r = &bench_results[bench_result_count++];
+    snprintf(r->workload, sizeof(r->workload), "%s", workload);
+    snprintf(r->op, sizeof(r->op), "%s", op);
+    r->count = count;
+    r->seconds = seconds;
+    r->height = height;
+    r->lots = lots;
+    r->rss_kb = rss;
+}
+
+// Append one CSV row per result; the header is written only to a new file
+int bench_write_csv(const char *path, unsigned long long seed, int lots, int ops) {
+    FILE *f = fopen(path, "a");
+    if (!f) return 0;
+    fseek(f, 0, SEEK_END);
+    if (ftell(f) == 0)
+        fprintf(f, "timestamp,index,seed,lots_arg,ops_arg,workload,op,count,ns_per_op,ops_per_sec,height,lots,peak_rss_kb\n");
+    long long stamp = (long long)time(NULL);
+    for (int i = 0; i < bench_result_count; i++) {
+        BenchResult *r = &bench_results[i];
+        fprintf(f, "%lld,%s,%llu,%d,%d,%s,%s,%ld,%.2f,%.0f,%d,%d,%ld\n",
+                stamp, LOT_INDEX_NAME, seed, lots, ops, r->workload, r->op, r->count,
+                r->count ? r->seconds * 1e9 / r->count : 0.0,
+                r->seconds > 0 ? r->count / r->seconds : 0.0,
+                r->height, r->lots, r->rss_kb);
+    }
+    fclose(f);
+    return 1;
+}
+
+int bench_write_json(const char *path, unsigned long long seed, int lots, int ops) {
+    FILE *f = fopen(path, "w");
+    if (!f) return 0;
+    fprintf(f, "{\n  \"timestamp\": %lld,\n  \"index\": \"%s\",\n  \"seed\": %llu,\n"
+               "  \"lots\": %d,\n  \"ops\": %d,\n  \"results\": [\n",
+            (long long)time(NULL), LOT_INDEX_NAME, seed, lots, ops);
+    for (int i = 0; i < bench_result_count; i++) {
+        BenchResult *r = &bench_results[i];
+        fprintf(f, "    {\"workload\": \"%s\", \"op\": \"%s\", \"count\": %ld, \"ns_per_op\": %.2f,"
+                   " \"ops_per_sec\": %.0f, \"height\": %d, \"lots\": %d, \"peak_rss_kb\": %ld}%s\n",
+                r->workload, r->op, r->count,
+                r->count ? r->seconds * 1e9 / r->count : 0.0,
+                r->seconds > 0 ? r->count / r->seconds : 0.0,
+                r->height, r->lots, r->rss_kb, i + 1 < bench_result_count ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    fclose(f);
+    return 1;
+}
+
+// ---------------------------------------------------------------------------
+// Cargas de lotes y colas
+// ---------------------------------------------------------------------------
+
+// Heavy-tailed order size: mostly small, occasionally up to 1000 units
+int skewed_quantity(void) {
+    return 1 + 1000 / (1 + (int)(bench_rand() % 1000));
+}
+
+// One seeded run over a single inventory, phase by phase:
+//   seq     dates received in increasing order
+//   random  dates received in random order
+//   skewed  random dates; 80% of orders hit 20% of the lots, heavy-tailed sizes
+//   longq   64 lots only, so every queue holds ops/64 orders and cancel scans them
+void bench_queue_workload(const char *kind, int lots, int ops) {
+    int longq = strcmp(kind, "longq") == 0;
+    int skewed = strcmp(kind, "skewed") == 0;
+    if (longq) lots = 64;
+    int *dates = malloc(sizeof(int) * (size_t)lots);
+    Inventory inv;
+    inventory_init(&inv);
+    double t0;
+
+    // insert: inventory_receive is insert_avl plus the O(1) lot-list bookkeeping
+    long span = 4L * lots;
+    if (span > 336L * 7999) span = 336L * 7999;
+    t0 = now_seconds();
+    for (int i = 0; i < lots;) {
+        int date = strcmp(kind, "seq") == 0 ? date_from_index(i)
+                                            : date_from_index((long)(bench_rand() % (unsigned long long)span));
+        if (inventory_receive(&inv, date, "Pescado", 1 << 30)) dates[i++] = date;
+    }
+    bench_record(kind, "insert", lots, now_seconds() - t0, height(inv.root), inv.lot_count);
+
+    t0 = now_seconds();
+    long long hits = 0;
+    for (int i = 0; i < ops; i++)
+        hits += find_node(inv.root, dates[bench_rand() % (unsigned long long)lots]) != NULL;
+    bench_record(kind, "find", ops, now_seconds() - t0, height(inv.root), inv.lot_count);
+    if (hits != ops) fprintf(stderr, "find: %lld de %d encontrados\n", hits, ops);
+
+    // lots and sizes are drawn before timing so only enqueue_order is measured
+    AVLNode **targets = malloc(sizeof(AVLNode *) * (size_t)(ops ? ops : 1));
+    int *sizes = malloc(sizeof(int) * (size_t)(ops ? ops : 1));
+    for (int i = 0; i < ops; i++) {
+        int idx = (int)(bench_rand() % (unsigned long long)lots);
+        if (skewed && bench_rand() % 100 < 80) idx = (int)(bench_rand() % (unsigned long long)(lots / 5 + 1));
+        targets[i] = find_node(inv.root, dates[idx]);
+        sizes[i] = skewed ? skewed_quantity() : 1 + (int)(bench_rand() % 50);
+    }
+    t0 = now_seconds();
+    for (int i = 0; i < ops; i++)
+        enqueue_order(targets[i], bench_destinations[i % BENCH_DEST_COUNT], sizes[i]);
+    bench_record(kind, "enqueue", ops, now_seconds() - t0, height(inv.root), inv.lot_count);
+
+    // cancel half of them by destination/quantity: a linear scan of the queue
+    int cancels = ops / 2;
+    t0 = now_seconds();
+    for (int i = 0; i < cancels; i++) {
+        int k = (int)(bench_rand() % (unsigned long long)ops);
+        cancel_order_in_node(targets[k], bench_destinations[k % BENCH_DEST_COUNT], sizes[k]);
+    }
+    bench_record(kind, "cancel", cancels, now_seconds() - t0, height(inv.root), inv.lot_count);
+
+    // report: count is lots printed, output goes to the null device
+#ifdef _WIN32
+    FILE *sink = fopen("NUL", "w");
+#else
+    FILE *sink = fopen("/dev/null", "w");
+#endif
+    if (sink) {
+        int rounds = ops / lots > 0 ? ops / lots : 1;
+        t0 = now_seconds();
+        for (int r = 0; r < rounds; r++) report_inorder(sink, &inv);
+        fflush(sink);
+        bench_record(kind, "report", (long)rounds * lots, now_seconds() - t0, height(inv.root), inv.lot_count);
+
+        // export: the same lots as CSV and JSON through the buffered writer,
+        // then random 100-lot pages (each one a rank lookup plus the page)
+        static OutBuf out;
+        out.fp = sink;
+        out.len = 0;
+        ExportSpec spec = {EXPORT_CSV, INT_MIN, INT_MAX, 0, 1};
+        t0 = now_seconds();
+        for (int r = 0; r < rounds; r++) export_lots(&out, NULL, &inv, &spec);
+        out_flush(&out);
+        bench_record(kind, "export_csv", (long)rounds * lots, now_seconds() - t0, height(inv.root), inv.lot_count);
+        spec.format = EXPORT_JSON;
+        t0 = now_seconds();
+        for (int r = 0; r < rounds; r++) export_lots(&out, NULL, &inv, &spec);
+        out_flush(&out);
+        bench_record(kind, "export_json", (long)rounds * lots, now_seconds() - t0, height(inv.root), inv.lot_count);
+        spec.format = EXPORT_CSV;
+        spec.page_size = 100;
+        long pages = (lots + 99) / 100;
+        t0 = now_seconds();
+        for (int i = 0; i < ops; i++) {
+            spec.page = 1 + (long)(bench_rand() % (unsigned long long)pages);
+            export_lots(&out, NULL, &inv, &spec);
+        }
+        out_flush(&out);
+        bench_record(kind, "export_page", ops, now_seconds() - t0, height(inv.root), inv.lot_count);
+        fclose(sink);
+    }
+
+    // delete: every lot in random order, queues included
+    for (int i = lots - 1; i > 0; i--) {
+        int j = (int)(bench_rand() % (unsigned long long)(i + 1));
+        int t = dates[i]; dates[i] = dates[j]; dates[j] = t;
+    }
+    int start_height = height(inv.root);
+    t0 = now_seconds();
+    for (int i = 0; i < lots; i++) inventory_drop(&inv, dates[i]);
+    bench_record(kind, "delete", lots, now_seconds() - t0, start_height, inv.lot_count);
+
+    inventory_free(&inv);
+    memory_release();
+    free(sizes);
+    free(targets);
+    free(dates);
+}
+
+// Receive/order/cancel/drop churn; reports heap traffic saved by the pools
+void bench_alloc_workload(int lots, int ops) {
+    AVLNode *root = NULL;
+    int *dates = malloc(sizeof(int) * (size_t)lots);
+    int count = 0;
+    memset(&alloc_stats, 0, sizeof(alloc_stats));
+
+    double t0 = now_seconds();
+    while (count < lots) {
+        int inserted = 0;
+        int date = random_date();
+        root = insert_avl(root, date, "Pescado", 1000000, &inserted);
+        if (inserted) dates[count++] = date;
+    }
+    for (int i = 0; i < ops; i++) {
+        int r = (int)(bench_rand() % 100);
+        int idx = (int)(bench_rand() % (unsigned long long)count);
+        AVLNode *node = find_node(root, dates[idx]);
+        const char *dest = bench_destinations[bench_rand() % BENCH_DEST_COUNT];
+        int qty = 1 + (int)(bench_rand() % 20);
+        if (r < 70) {
+            enqueue_order(node, dest, qty);
+        } else if (r < 85) {
+            if (order_index.next_id)
+                cancel_order_by_id(1 + (int)(bench_rand() % (unsigned long long)order_index.next_id));
+        } else if (r < 95) {
+            if (node && node->head)
+                cancel_order_in_node(node, intern_name(node->head->dest_id[node->head->begin]),
+                                     node->head->quantity[node->head->begin]);
+        } else {
+            int deleted = 0, inserted = 0, date;
+            root = delete_avl(root, dates[idx], &deleted);
+            do {
+                date = random_date();
+                root = insert_avl(root, date, "Pescado", 1000000, &inserted);
+            } while (!inserted);
+            dates[idx] = date;
+        }
+    }
+    int final_height = height(root);
+    free_tree(root);
+    double elapsed = now_seconds() - t0;
+
+    long long logical = alloc_stats.pool_allocs + alloc_stats.string_allocs;
+    bench_record("alloc", "churn", ops, elapsed, final_height, count);
+    printf("  asignaciones logicas (sin pool = 1 malloc c/u): %lld\n", logical);
+    printf("  mallocs reales con pool: %lld\n", alloc_stats.heap_allocs);
+    printf("  objetos reciclados de la lista libre: %lld de %lld\n",
+           alloc_stats.pool_reuses, alloc_stats.pool_allocs);
+    printf("  bytes en arena de cadenas: %lld (%d cadenas internadas)\n",
+           alloc_stats.arena_bytes, strings.count);
+    printf("  bytes por pedido: %zu\n", sizeof(OrderChunk) / ORDER_CHUNK);
+    memory_release();
+    free(dates);
+}
+
+// Delete lots with empty queues whose neighbours (the in-order successors
+// that get spliced into their place) each hold queue_len orders. Deletion
+// relinks the successor instead of copying its queue, so ns/delete must
+// stay flat as queue_len grows and no allocation may happen.
+void bench_delete_workload(int lots, int queue_len) {
+    AVLNode *root = NULL;
+    int *dates = malloc(sizeof(int) * (size_t)lots);
+    int victims = 0;
+    for (int i = 0; i < lots; i++) {
+        int inserted = 0, date = i + 1;
+        root = insert_avl(root, date, "Pescado", queue_len, &inserted);
+        if (date % 2) { dates[victims++] = date; continue; }
+        AVLNode *node = find_node(root, date);
+        for (int q = 0; q < queue_len; q++)
+            enqueue_order(node, bench_destinations[q % BENCH_DEST_COUNT], 1);
+    }
+    for (int i = victims - 1; i > 0; i--) {
+        int j = (int)(bench_rand() % (unsigned long long)(i + 1));
+        int t = dates[i]; dates[i] = dates[j]; dates[j] = t;
+    }
+
+    long long allocs_before = alloc_stats.pool_allocs;
+    double t0 = now_seconds();
+    for (int i = 0; i < victims; i++) {
+        int deleted = 0;
+        root = delete_avl(root, dates[i], &deleted);
+    }
+    double elapsed = now_seconds() - t0;
+    char op[24];
+    snprintf(op, sizeof(op), "queue-%d", queue_len);
+    bench_record("delete", op, victims, elapsed, height(root), lots - victims);
+    if (alloc_stats.pool_allocs != allocs_before)
+        printf("  delete: %lld asignaciones durante el borrado\n", alloc_stats.pool_allocs - allocs_before);
+    free_tree(root);
+    memory_release();
+    free(dates);
+}
+
+// Results of timed loops land here so the compiler cannot drop them
+volatile long long bench_sink;
+
+// Compare the AVL against the B+-tree index on the same sorted lots:
+// random point lookups and a full in-order scan (pointer chasing vs leaves)
+void bench_index_workload(long lots, int lookups) {
+    AVLNode **nodes = malloc(sizeof(AVLNode *) * (size_t)lots);
+    int *probe = malloc(sizeof(int) * (size_t)lookups);
+    for (long i = 0; i < lots; i++) nodes[i] = new_node_id((int)(i * 3 + 1), 0, 1);
+    AVLNode *root = build_balanced(nodes, 0, lots - 1);
+    BTree index = {0};
+    btree_build(&index, nodes, lots);
+    for (int i = 0; i < lookups; i++) probe[i] = (int)(bench_rand() % (unsigned long long)lots) * 3 + 1;
+
+    long long sum = 0;
+    double t0 = now_seconds();
+    for (int i = 0; i < lookups; i++) sum += find_node(root, probe[i])->stock;
+    double avl_find = now_seconds() - t0;
+    t0 = now_seconds();
+    for (int i = 0; i < lookups; i++) sum += btree_find(&index, probe[i])->stock;
+    double bt_find = now_seconds() - t0;
+
+    // In-order walk of the AVL with an explicit stack (no lot list)
+    AVLNode **stack = malloc(sizeof(AVLNode *) * (size_t)(root->height + 1));
+    t0 = now_seconds();
+    int top = 0, avl_height = root->height;
+    for (AVLNode *n = root; n || top;) {
+        while (n) { stack[top++] = n; n = n->left; }
+        n = stack[--top];
+        sum += n->date;
+        n = n->right;
+    }
+    double avl_scan = now_seconds() - t0;
+    t0 = now_seconds();
+    for (BTNode *leaf = index.first; leaf; leaf = leaf->next)
+        for (int i = 0; i < leaf->count; i++) sum += ((AVLNode *)leaf->ptr[i])->date;
+    double bt_scan = now_seconds() - t0;
+
+    bench_record("index", "find-avl", lookups, avl_find, avl_height, (int)lots);
+    bench_record("index", "find-btree", lookups, bt_find, index.height, (int)lots);
+    bench_record("index", "scan-avl", lots, avl_scan, avl_height, (int)lots);
+    bench_record("index", "scan-btree", lots, bt_scan, index.height, (int)lots);
+    bench_sink = sum;
+    btree_free(&index);
+    free(stack);
+    free_tree(root);
+    memory_release();
+    free(probe);
+    free(nodes);
+}
+
+#ifdef CONCURRENT_INTAKE
+// Multi-threaded stress: every worker takes orders on random lots through
+// intake_order and, one time in 20, runs a range query under the read lock,
+// while the main thread drains the inboxes (write lock) every 100 us.
+typedef struct IntakeWorker {
+    pthread_t thread;
+    Inventory *inv;
+    const int *dates;
+    int lots;
+    int ops;
+    unsigned long long rng;
+    long accepted;
+    long long reserved;
+    long long checksum;
+} IntakeWorker;
+
+int intake_running; // workers still taking orders
+
+void *intake_worker(void *arg) {
+    IntakeWorker *w = arg;
+    for (int i = 0; i < w->ops; i++) {
+        unsigned long long x = w->rng;
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;
+        w->rng = x;
+        int date = w->dates[x % (unsigned long long)w->lots];
+        if ((x >> 32) % 20 == 0) {
+            inventory_read_begin(w->inv);
+            RangeTotals t = totals_between(w->inv->root, date, date + 100);
+            w->checksum += t.stock;
+            inventory_read_end(w->inv);
+            continue;
+        }
+        int qty = 1 + (int)((x >> 40) % 10);
+        if (intake_order(w->inv, date, bench_destinations[(x >> 20) % BENCH_DEST_COUNT], qty) > 0) {
+            w->accepted++;
+            w->reserved += qty;
+        }
+    }
+    intake_thread_exit(w->inv);
+    __atomic_sub_fetch(&intake_running, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+void bench_intake_workload(int lots, int ops, int threads) {
+    Inventory inv;
+    inventory_init(&inv);
+    int *dates = malloc(sizeof(int) * (size_t)lots);
+    for (int i = 0; i < lots; i++) {
+        dates[i] = date_from_index(i);
+        inventory_receive(&inv, dates[i], "Pescado", 1 << 20);
+    }
+    for (int d = 0; d < BENCH_DEST_COUNT; d++) intern(bench_destinations[d]);
+    long long stock_before = total_stock(inv.root);
+
+    IntakeWorker *w = calloc((size_t)threads, sizeof(IntakeWorker));
+    double t0 = now_seconds();
+    __atomic_store_n(&intake_running, threads, __ATOMIC_RELEASE);
+    for (int i = 0; i < threads; i++) {
+        w[i] = (IntakeWorker){ .inv = &inv, .dates = dates, .lots = lots, .ops = ops / threads,
+                               .rng = bench_rand() | 1 };
+        pthread_create(&w[i].thread, NULL, intake_worker, &w[i]);
+    }
+    struct timespec pause_100us = {0, 100000};
+    while (__atomic_load_n(&intake_running, __ATOMIC_ACQUIRE) > 0) {
+        nanosleep(&pause_100us, NULL);
+        inventory_write_begin(&inv);
+        inventory_write_end(&inv);
+    }
+    for (int i = 0; i < threads; i++) pthread_join(w[i].thread, NULL);
+    inventory_write_begin(&inv);
+    double elapsed = now_seconds() - t0;
+
+    long accepted = 0;
+    long long reserved = 0;
+    for (int i = 0; i < threads; i++) {
+        accepted += w[i].accepted;
+        reserved += w[i].reserved;
+        bench_sink += w[i].checksum;
+    }
+    char op[24];
+    snprintf(op, sizeof(op), "threads-%d", threads);
+    bench_record("intake", op, (long)(ops / threads) * threads, elapsed, height(inv.root), inv.lot_count);
+    if (total_orders(inv.root) != accepted || total_stock(inv.root) != stock_before - reserved)
+        printf("  intake: inconsistente: %lld pedidos en colas, %ld aceptados\n", total_orders(inv.root), accepted);
+    inventory_write_end(&inv);
+
+    inventory_free(&inv);
+    memory_release();
+    free(w);
+    free(dates);
+}
+
+// Recovery check across products: orders Leche:1, Queso:2, Leche:3 taken by
+// intake must reach the journal in id order, so the replay gives each order
+// its id back and CANCELID 2 cancels Queso's order again, not Leche's.
+void bench_intake_recovery(void) {
+    const char *path = "bench_journal.tmp";
+    const char *products[2] = {"Leche", "Queso"};
+    long long stock[2], orders[2];
+    remove(path);
+    Catalog cat;
+    catalog_init(&cat);
+    if (!journal_open(path)) { perror(path); return; }
+    catalog_write_begin(&cat);
+    for (int p = 0; p < 2; p++) catalog_receive(&cat, 20250101, products[p], 100);
+    catalog_write_end(&cat);
+    catalog_intake_order(&cat, "Leche", 20250101, "Norte", 1);
+    catalog_intake_order(&cat, "Queso", 20250101, "Sur", 2);
+    catalog_intake_order(&cat, "Leche", 20250101, "Norte", 3);
+    catalog_write_begin(&cat);
+    cancel_order_by_id(2);
+    for (int p = 0; p < 2; p++) {
+        AVLNode *root = catalog_get(&cat, intern_find(products[p]))->root;
+        stock[p] = total_stock(root);
+        orders[p] = total_orders(root);
+    }
+    catalog_write_end(&cat);
+    fclose(journal.fp);
+    journal.fp = NULL;
+    catalog_free(&cat);
+    memory_release();
+
+    journal_replay(&cat, path);
+    int ok = order_index_find(1) && !order_index_find(2) && order_index_find(3);
+    for (int p = 0; p < 2; p++) {
+        Inventory *inv = catalog_get(&cat, intern_find(products[p]));
+        ok = ok && inv && total_stock(inv->root) == stock[p] && total_orders(inv->root) == orders[p];
+    }
+    printf("intake   recovery        %s\n", ok ? "ok" : "inconsistente");
+    catalog_free(&cat);
+    memory_release();
+    remove(path);
+}
+#endif
+
+// Enqueue ops orders over the lots, then dispatch them all: orders taken from
+// the queues on this thread, then grouped by destination and shipped. With
+// CONCURRENT_INTAKE only the shipping runs on the workers, and the time
+// includes them emptying their rings.
+void bench_dispatch_workload(int lots, int ops, int workers) {
+    Inventory inv;
+    inventory_init(&inv);
+    for (int i = 0; i < lots; i++) inventory_receive(&inv, date_from_index(i), "Pescado", 1 << 20);
+    for (int i = 0; i < ops; i++) {
+        AVLNode *lot = inventory_find(&inv, date_from_index((int)(bench_rand() % (unsigned long long)lots)));
+        enqueue_order(lot, bench_destinations[bench_rand() % BENCH_DEST_COUNT], 1 + (int)(bench_rand() % 10));
+    }
+    memset(&dispatch_stats, 0, sizeof(dispatch_stats));
+    long long units;
+    double t0 = now_seconds();
+#ifdef CONCURRENT_INTAKE
+    dispatch_workers = workers;
+    int n = dispatch_orders(NULL, &inv, INT_MAX, &units);
+    dispatch_stop();
+#else
+    (void)workers;
+    int n = dispatch_orders(NULL, &inv, INT_MAX, &units);
+#endif
+    double elapsed = now_seconds() - t0;
+    char op[24];
+    if (workers) snprintf(op, sizeof(op), "workers-%d", workers);
+    else snprintf(op, sizeof(op), "inline");
+    bench_record("dispatch", op, n, elapsed, height(inv.root), inv.lot_count);
+    printf("  envios %lld, esperas por anillo lleno %lld, latencia p50 %lld ns, p99 %lld ns\n",
+           dispatch_stats.shipments, dispatch_stats.stalls,
+           latency_percentile(&dispatch_stats.latency, 50), latency_percentile(&dispatch_stats.latency, 99));
+    if (n != ops || total_orders(inv.root) != 0) printf("  dispatch: inconsistente: %d de %d pedidos\n", n, ops);
+    inventory_free(&inv);
+    memory_release();
+}
+
+// Enqueue ops orders over the lots, move the clock past half of them and keep
+// taking orders (on the lots still valid) while the sweep retires the expired
+// half in bounded steps: "sweep" is the whole retirement, the line below it
+// shows how long a single step and an order placed in between took.
+void bench_expiry_workload(int lots, int ops) {
+    Catalog cat;
+    catalog_init(&cat);
+    for (int i = 0; i < lots; i++) catalog_receive(&cat, date_from_index(i), "Pescado", 1 << 20);
+    Inventory *inv = catalog_get(&cat, intern_find("Pescado"));
+    for (int i = 0; i < ops; i++) {
+        AVLNode *lot = inventory_find(inv, date_from_index((int)(bench_rand() % (unsigned long long)lots)));
+        enqueue_order(lot, bench_destinations[bench_rand() % BENCH_DEST_COUNT], 1 + (int)(bench_rand() % 10));
+    }
+    long long orders = total_orders(inv->root);
+    expiry_set_clock(date_from_index(lots / 2));
+    LatencyHist intake = {0};
+    long steps = 0;
+    double t0 = now_seconds();
+    while (expiry.armed) {
+        expiry_tick(&cat);
+        steps++;
+        long long s0 = stats_now_ns();
+        AVLNode *lot = inventory_find(inv, date_from_index(lots / 2 + (int)(bench_rand() % (unsigned long long)(lots - lots / 2))));
+        enqueue_order(lot, bench_destinations[bench_rand() % BENCH_DEST_COUNT], 1);
+        latency_add(&intake, stats_now_ns() - s0);
+    }
+    double elapsed = now_seconds() - t0;
+    bench_record("expiry", "sweep", expiry.moved + expiry.failed, elapsed, height(inv->root), inv->lot_count);
+    printf("  pasos %ld, lotes retirados %lld, pedidos movidos %lld, fallidos %lld; paso p99 %lld ns, max %lld ns; "
+           "pedido entre pasos p99 %lld ns\n", steps, expiry.retired, expiry.moved, expiry.failed,
+           latency_percentile(&expiry.latency, 99), expiry.latency.max_ns, latency_percentile(&intake, 99));
+    if (expiry.failed + total_orders(inv->root) != orders + steps)
+        printf("  expiry: inconsistente\n");
+    expiry = (ExpiryClock){ .today = INT_MIN };
+    catalog_free(&cat);
+    memory_release();
+}
+
+int bench_selected(int argc, char **argv, const char *name) {
+    int any = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--csv") == 0 || strcmp(argv[i], "--json") == 0) { i++; continue; }
+        if (argv[i][0] >= '0' && argv[i][0] <= '9') continue;
+        any = 1;
+        if (strcmp(argv[i], name) == 0 || strcmp(argv[i], "all") == 0) return 1;
+    }
+    return !any;
+}
+
+int main(int argc, char **argv) {
+    int lots = 10000, ops = 1000000, positional = 0, bad = 0;
+    unsigned long long seed = bench_rng_state;
+    const char *csv_path = NULL, *json_path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "--csv") == 0 || strcmp(argv[i], "--json") == 0) && i + 1 < argc) {
+            if (argv[i][2] == 'c') csv_path = argv[++i];
+            else json_path = argv[++i];
+        } else if (argv[i][0] >= '0' && argv[i][0] <= '9') {
+            if (positional == 0) lots = atoi(argv[i]);
+            else if (positional == 1) ops = atoi(argv[i]);
+            else seed = strtoull(argv[i], NULL, 10) | 1;
+            positional++;
+        } else if (argv[i][0] == '-') {
+            bad = 1;
+        }
+    }
+    if (bad || lots <= 0 || ops < 0) {
+        fprintf(stderr, "Uso: %s [lotes] [operaciones] [semilla] [--csv archivo] [--json archivo] "
+                        "[seq|random|skewed|longq|alloc|delete|index|intake|dispatch|expiry|all]...\n", argv[0]);
+        return 1;
+    }
+    bench_rng_state = seed;
+    printf("indice: %s, lotes %d, operaciones %d, semilla %llu\n", LOT_INDEX_NAME, lots, ops, seed);
+
+    const char *queue_kinds[] = {"seq", "random", "skewed", "longq"};
+    for (int k = 0; k < 4; k++)
+        if (bench_selected(argc, argv, queue_kinds[k])) bench_queue_workload(queue_kinds[k], lots, ops);
+    if (bench_selected(argc, argv, "alloc")) bench_alloc_workload(lots, ops);
+    if (bench_selected(argc, argv, "delete"))
+        for (int q = 0; q <= 1000; q = q ? q * 10 : 1)
+            bench_delete_workload(lots / 10 > 1 ? lots / 10 : 2, q);
+    if (bench_selected(argc, argv, "index"))
+        for (long n = 10000; n <= 100L * lots && n <= 10000000; n *= 10)
+            bench_index_workload(n, 1000000);
+#ifdef CONCURRENT_INTAKE
+    if (bench_selected(argc, argv, "intake")) {
+        for (int t = 1; t <= 16; t *= 2)
+            bench_intake_workload(lots, ops, t);
+        bench_intake_recovery();
+    }
+    if (bench_selected(argc, argv, "dispatch"))
+        for (int w = 1; w <= 8; w *= 2)
+            bench_dispatch_workload(lots, ops, w);
+#else
+    if (bench_selected(argc, argv, "dispatch")) bench_dispatch_workload(lots, ops, 0);
+#endif
+    if (bench_selected(argc, argv, "expiry")) bench_expiry_workload(lots, ops);
+
+    if (csv_path && !bench_write_csv(csv_path, seed, lots, ops)) {
+        fprintf(stderr, "No se pudo escribir %s\n", csv_path);
+        return 1;
+    }
+    if (json_path && !bench_write_json(json_path, seed, lots, ops)) {
+        fprintf(stderr, "No se pudo escribir %s\n", json_path);
+        return 1;
+    }
+    return 0;
+}
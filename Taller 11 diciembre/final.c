@@ -7,94 +7,712 @@
  *  - Baja de producto (eliminar nodo y su cola)
  *  - Cancelar pedido (eliminar un pedido específico y restaurar stock)
  *  - Reporte de estado (in-order)
+ *  - Modo batch: final.exe --batch [archivo] procesa un flujo de comandos sin menú
  *
  * Compilar: gcc final.c -o final.exe
+ * Con recepción concurrente de pedidos: gcc -DCONCURRENT_INTAKE -pthread final.c -o final.exe
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <time.h>
+#ifdef CONCURRENT_INTAKE
+#include <pthread.h>
+#endif
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 #define MAX_NAME 64
 
+// Counters are per thread when several threads may take orders at once
+#ifdef CONCURRENT_INTAKE
+#define STATS_TLS _Thread_local
+#else
+#define STATS_TLS
+#endif
+
+#define ORDER_CHUNK 32 // orders per block of a lot's queue
+
+// A lot's FIFO is an unrolled list of fixed-size blocks, one array per field,
+// so walking a queue reads the destinations and quantities of 32 orders from
+// a few cache lines instead of touching one node per order. Orders join at
+// `end` and leave from `begin`; one cancelled in the middle leaves a hole
+// (id 0) so the rest never move and the order index can keep (chunk, slot).
+// A block is released when its last order leaves.
+typedef struct OrderChunk {
+    struct OrderChunk *next;
+    struct OrderChunk *prev;
+    struct AVLNode *lot; // lot whose stock these orders reserved
+    int begin, end;      // used slots [begin, end)
+    int live;            // orders in [begin, end) that are not holes
+    int id[ORDER_CHUNK];      // unique order ids returned by enqueue_order, 0 = hole
+    int dest_id[ORDER_CHUNK]; // interned destinations (see intern)
+    int quantity[ORDER_CHUNK];
+    long long created_ns[ORDER_CHUNK]; // enqueue time, for the end-to-end dispatch latency
+} OrderChunk;
+
+#ifdef CONCURRENT_INTAKE
+// Order accepted by intake_order, waiting in its lot's inbox for the next drain
 typedef struct Order {
-    char *destination;
+    int id;
+    int dest_id;
     int quantity;
     struct Order *next;
+    struct AVLNode *lot;
+    int scope;            // product_id of the inventory it was taken on, for the journal
+    long long created_ns;
 } Order;
+#endif
 
 typedef struct AVLNode {
     int date; // AAAAMMDD
-    char *product;
+    int product_id; // interned product name
     int stock;
-    Order *head;
-    Order *tail;
+    OrderChunk *head; // pending orders, oldest first
+    OrderChunk *tail;
     struct AVLNode *left;
     struct AVLNode *right;
     int height;
+    struct AVLNode *prev_lot; // in-order neighbours (date order)
+    struct AVLNode *next_lot;
+    struct AVLNode *parent;
+    int order_count;          // pending orders in this lot's queue
+    // subtree aggregates (this node plus both subtrees)
+    long long total_stock;
+    long long total_orders;
+    int total_lots;
+    int max_stock;            // largest single-lot stock, guides the expiry sweep
+#ifdef CONCURRENT_INTAKE
+    Order *inbox;                 // lock-free MPSC stack filled by intake_order
+    struct AVLNode *dirty_next;   // link in intake_dirty while inbox is non-empty
+#endif
 } AVLNode;
 
-// Utility: allocate string copy
+// ---------------------------------------------------------------------------
+// Memoria: slabs de tamaño fijo para AVLNode/Order con lista libre, y una
+// arena de avance (bump) para las cadenas. Los slots liberados por
+// delete_avl/cancel_order_in_node se reciclan sin volver al heap.
+// ---------------------------------------------------------------------------
+
+#define SLAB_OBJECTS 1024
+#define ARENA_BLOCK (64 * 1024)
+#define ALIGN_UP(n) (((n) + 15) & ~(size_t)15)
+
+typedef struct AllocStats {
+    long long heap_allocs;    // real malloc calls (slabs + arena blocks)
+    long long heap_frees;     // real free calls
+    long long pool_allocs;    // objects handed out by the pools
+    long long pool_reuses;    // ...of which recycled from a free list
+    long long pool_frees;     // objects returned to a free list
+    long long string_allocs;  // strings copied into the arena
+    long long arena_bytes;    // bytes used in the arena
+} AllocStats;
+
+STATS_TLS AllocStats alloc_stats;
+
+typedef struct Slab { struct Slab *next; } Slab;
+typedef struct FreeSlot { struct FreeSlot *next; } FreeSlot;
+
+typedef struct Pool {
+    size_t obj_size;
+    Slab *slabs;
+    char *cursor;       // next unused object in the current slab
+    size_t remaining;   // unused objects left in the current slab
+    FreeSlot *free_list;
+} Pool;
+
+typedef struct ArenaBlock { struct ArenaBlock *next; } ArenaBlock;
+
+typedef struct Arena {
+    ArenaBlock *blocks;
+    char *cursor;
+    size_t remaining;
+} Arena;
+
+void *pool_alloc(Pool *pool) {
+    alloc_stats.pool_allocs++;
+    if (pool->free_list) {
+        FreeSlot *slot = pool->free_list;
+        pool->free_list = slot->next;
+        alloc_stats.pool_reuses++;
+        return slot;
+    }
+    if (!pool->remaining) {
+        size_t obj = ALIGN_UP(pool->obj_size);
+        Slab *slab = malloc(ALIGN_UP(sizeof(Slab)) + obj * SLAB_OBJECTS);
+        if (!slab) { alloc_stats.pool_allocs--; return NULL; }
+        alloc_stats.heap_allocs++;
+        slab->next = pool->slabs;
+        pool->slabs = slab;
+        pool->cursor = (char *)slab + ALIGN_UP(sizeof(Slab));
+        pool->remaining = SLAB_OBJECTS;
+    }
+    void *p = pool->cursor;
+    pool->cursor += ALIGN_UP(pool->obj_size);
+    pool->remaining--;
+    return p;
+}
+
+void pool_free(Pool *pool, void *p) {
+    if (!p) return;
+    FreeSlot *slot = p;
+    slot->next = pool->free_list;
+    pool->free_list = slot;
+    alloc_stats.pool_frees++;
+}
+
+// Release every slab at once: O(number of slabs)
+void pool_destroy(Pool *pool) {
+    while (pool->slabs) {
+        Slab *s = pool->slabs;
+        pool->slabs = s->next;
+        free(s);
+        alloc_stats.heap_frees++;
+    }
+    pool->cursor = NULL;
+    pool->remaining = 0;
+    pool->free_list = NULL;
+}
+
+// Move every slab, free slot and unused object of src into dst
+void pool_adopt(Pool *dst, Pool *src) {
+    while (src->remaining) {
+        FreeSlot *slot = (FreeSlot *)src->cursor;
+        slot->next = dst->free_list;
+        dst->free_list = slot;
+        src->cursor += ALIGN_UP(src->obj_size);
+        src->remaining--;
+    }
+    while (src->free_list) {
+        FreeSlot *slot = src->free_list;
+        src->free_list = slot->next;
+        slot->next = dst->free_list;
+        dst->free_list = slot;
+    }
+    while (src->slabs) {
+        Slab *slab = src->slabs;
+        src->slabs = slab->next;
+        slab->next = dst->slabs;
+        dst->slabs = slab;
+    }
+    src->cursor = NULL;
+}
+
+char *arena_alloc(Arena *a, size_t n) {
+    if (n > a->remaining) {
+        size_t size = n > ARENA_BLOCK ? n : ARENA_BLOCK;
+        ArenaBlock *b = malloc(ALIGN_UP(sizeof(ArenaBlock)) + size);
+        if (!b) return NULL;
+        alloc_stats.heap_allocs++;
+        b->next = a->blocks;
+        a->blocks = b;
+        a->cursor = (char *)b + ALIGN_UP(sizeof(ArenaBlock));
+        a->remaining = size;
+    }
+    char *p = a->cursor;
+    a->cursor += n;
+    a->remaining -= n;
+    alloc_stats.arena_bytes += (long long)n;
+    return p;
+}
+
+void arena_destroy(Arena *a) {
+    while (a->blocks) {
+        ArenaBlock *b = a->blocks;
+        a->blocks = b->next;
+        free(b);
+        alloc_stats.heap_frees++;
+    }
+    a->cursor = NULL;
+    a->remaining = 0;
+}
+
+Pool node_pool = { .obj_size = sizeof(AVLNode) };
+Pool chunk_pool = { .obj_size = sizeof(OrderChunk) };
+#ifdef CONCURRENT_INTAKE
+Pool order_pool = { .obj_size = sizeof(Order) }; // drained orders, taken back by intake_order
+_Thread_local Pool intake_pool = { .obj_size = sizeof(Order) }; // orders made by intake_order
+#endif
+Arena string_arena;
+
+// Utility: allocate string copy (lives in the arena until memory_release)
 char *strdup_alloc(const char *s) {
     if (!s) return NULL;
     size_t n = strlen(s) + 1;
-    char *p = malloc(n);
+    char *p = arena_alloc(&string_arena, n);
     if (!p) return NULL;
     memcpy(p, s, n);
+    alloc_stats.string_allocs++;
     return p;
 }
 
+// ---------------------------------------------------------------------------
+// Instrumentación: contadores del árbol y latencias acumuladas por operación
+// (histograma en potencias de 2 de nanosegundos). Se consultan con STATS o la
+// opción de menú, y opcionalmente se vuelcan a un archivo cada N operaciones.
+// ---------------------------------------------------------------------------
+
+typedef struct TreeStats {
+    long long comparisons; // date comparisons in find/insert/delete
+    long long rotations;   // single rotations (a double rotation counts 2)
+} TreeStats;
+
+STATS_TLS TreeStats tree_stats;
+
+enum { OP_RECV, OP_ORDER, OP_DROP, OP_CANCEL, OP_QUERY, OP_EXPIRE, OP_LOAD, OP_SNAPSHOT, OP_REPORT, OP_EXPORT, OP_DISPATCH, OP_COUNT };
+const char *op_names[OP_COUNT] = {"recv", "order", "drop", "cancel", "query", "expire", "load", "snapshot", "report", "export",
+                                  "dispatch"};
+
+#define LAT_BUCKETS 40 // bucket b counts latencies in [2^b, 2^(b+1)) ns
+
+typedef struct LatencyHist {
+    long long count;
+    long long total_ns;
+    long long max_ns;
+    long long buckets[LAT_BUCKETS];
+} LatencyHist;
+
+LatencyHist op_latency[OP_COUNT];
+
+// Monotonic: a wall-clock step (NTP, manual change) would skew the samples
+long long stats_now_ns(void) {
+    struct timespec ts;
+#ifdef _WIN32
+    timespec_get(&ts, TIME_UTC);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void latency_add(LatencyHist *h, long long ns) {
+    if (ns < 0) ns = 0;
+    int b = 0;
+    while (b + 1 < LAT_BUCKETS && (ns >> (b + 1))) b++;
+    h->count++;
+    h->total_ns += ns;
+    if (ns > h->max_ns) h->max_ns = ns;
+    h->buckets[b]++;
+}
+
+void latency_merge(LatencyHist *dst, const LatencyHist *src) {
+    dst->count += src->count;
+    dst->total_ns += src->total_ns;
+    if (src->max_ns > dst->max_ns) dst->max_ns = src->max_ns;
+    for (int b = 0; b < LAT_BUCKETS; b++) dst->buckets[b] += src->buckets[b];
+}
+
+// Record one operation of kind op that started at start_ns
+void stats_record(int op, long long start_ns) {
+    latency_add(&op_latency[op], stats_now_ns() - start_ns);
+}
+
+// Upper bound (ns) of the bucket holding the given percentile
+long long latency_percentile(const LatencyHist *h, int pct) {
+    if (!h->count) return 0;
+    long long rank = (h->count * pct + 99) / 100, seen = 0;
+    for (int b = 0; b < LAT_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen >= rank) return (2LL << b) - 1 < h->max_ns ? (2LL << b) - 1 : h->max_ns;
+    }
+    return h->max_ns;
+}
+
+// ---------------------------------------------------------------------------
+// Tabla de cadenas internadas: cada destino/producto distinto se guarda una
+// sola vez y se identifica con un entero pequeño (0, 1, 2, ...).
+// ---------------------------------------------------------------------------
+
+typedef struct StringTable {
+    char **names;      // id -> name (names live in string_arena)
+    unsigned *hashes;  // id -> hash, reused when the table grows
+    int count;
+    int names_cap;
+    int *slots;        // open addressing: id + 1, 0 = empty
+    int slots_cap;     // power of two
+} StringTable;
+
+StringTable strings;
+
+unsigned hash_string(const char *s) {
+    unsigned h = 2166136261u;
+    while (*s) { h ^= (unsigned char)*s++; h *= 16777619u; }
+    return h;
+}
+
+int intern_grow(StringTable *t) {
+    int cap = t->slots_cap ? t->slots_cap * 2 : 64;
+    int *slots = calloc((size_t)cap, sizeof(int));
+    if (!slots) return 0;
+    for (int id = 0; id < t->count; id++) {
+        unsigned i = t->hashes[id] & (unsigned)(cap - 1);
+        while (slots[i]) i = (i + 1) & (unsigned)(cap - 1);
+        slots[i] = id + 1;
+    }
+    free(t->slots);
+    t->slots = slots;
+    t->slots_cap = cap;
+    return 1;
+}
+
+// Id of s if already interned, -1 otherwise
+int intern_find(const char *s) {
+    StringTable *t = &strings;
+    if (!t->slots_cap) return -1;
+    unsigned h = hash_string(s);
+    unsigned i = h & (unsigned)(t->slots_cap - 1);
+    while (t->slots[i]) {
+        int id = t->slots[i] - 1;
+        if (t->hashes[id] == h && strcmp(t->names[id], s) == 0) return id;
+        i = (i + 1) & (unsigned)(t->slots_cap - 1);
+    }
+    return -1;
+}
+
+// Id of s, adding it to the table on first use; -1 if out of memory
+int intern(const char *s) {
+    StringTable *t = &strings;
+    int id = intern_find(s);
+    if (id >= 0) return id;
+    if ((t->count + 1) * 4 > t->slots_cap * 3 && !intern_grow(t)) return -1;
+    if (t->count == t->names_cap) {
+        int cap = t->names_cap ? t->names_cap * 2 : 64;
+        char **names = realloc(t->names, sizeof(char *) * (size_t)cap);
+        if (!names) return -1;
+        t->names = names;
+        unsigned *hashes = realloc(t->hashes, sizeof(unsigned) * (size_t)cap);
+        if (!hashes) return -1;
+        t->hashes = hashes;
+        t->names_cap = cap;
+    }
+    char *copy = strdup_alloc(s);
+    if (!copy) return -1;
+    unsigned h = hash_string(s);
+    unsigned i = h & (unsigned)(t->slots_cap - 1);
+    while (t->slots[i]) i = (i + 1) & (unsigned)(t->slots_cap - 1);
+    id = t->count++;
+    t->names[id] = copy;
+    t->hashes[id] = h;
+    t->slots[i] = id + 1;
+    return id;
+}
+
+const char *intern_name(int id) {
+    return (id >= 0 && id < strings.count) ? strings.names[id] : "?";
+}
+
+// ---------------------------------------------------------------------------
+// Índice de pedidos: id -> (bloque, posición), tabla hash con sondeo lineal.
+// Permite cancelar un pedido en O(1) sin recorrer la cola de su lote; el id
+// se guarda en la propia entrada, así sondear no toca los bloques.
+// ---------------------------------------------------------------------------
+
+typedef struct OrderRef {
+    int id;            // 0 = empty entry
+    int slot;          // position inside the chunk
+    OrderChunk *chunk;
+} OrderRef;
+
+typedef struct OrderIndex {
+    OrderRef *slots;
+    int cap;        // power of two
+    int count;
+    int next_id;    // last id handed out (atomic add in intake_order, plain under the write lock)
+} OrderIndex;
+
+OrderIndex order_index;
+
+unsigned order_slot(int id, int cap) {
+    return ((unsigned)id * 2654435761u) & (unsigned)(cap - 1);
+}
+
+int order_index_grow(OrderIndex *ix) {
+    int cap = ix->cap ? ix->cap * 2 : 1024;
+    OrderRef *slots = calloc((size_t)cap, sizeof(OrderRef));
+    if (!slots) return 0;
+    for (int i = 0; i < ix->cap; i++) {
+        if (!ix->slots[i].id) continue;
+        unsigned j = order_slot(ix->slots[i].id, cap);
+        while (slots[j].id) j = (j + 1) & (unsigned)(cap - 1);
+        slots[j] = ix->slots[i];
+    }
+    free(ix->slots);
+    ix->slots = slots;
+    ix->cap = cap;
+    return 1;
+}
+
+int order_index_add(int id, OrderChunk *chunk, int slot) {
+    OrderIndex *ix = &order_index;
+    if ((ix->count + 1) * 4 > ix->cap * 3 && !order_index_grow(ix)) return 0;
+    unsigned j = order_slot(id, ix->cap);
+    while (ix->slots[j].id) j = (j + 1) & (unsigned)(ix->cap - 1);
+    ix->slots[j] = (OrderRef){ id, slot, chunk };
+    ix->count++;
+    return 1;
+}
+
+// Entry of a pending order, NULL if unknown; valid until the index changes
+OrderRef *order_index_find(int id) {
+    OrderIndex *ix = &order_index;
+    if (!ix->cap || id <= 0) return NULL;
+    unsigned j = order_slot(id, ix->cap);
+    while (ix->slots[j].id) {
+        if (ix->slots[j].id == id) return &ix->slots[j];
+        j = (j + 1) & (unsigned)(ix->cap - 1);
+    }
+    return NULL;
+}
+
+// Remove by backward-shift so probing never needs tombstones
+void order_index_remove(int id) {
+    OrderIndex *ix = &order_index;
+    if (!ix->cap) return;
+    unsigned mask = (unsigned)(ix->cap - 1);
+    unsigned j = order_slot(id, ix->cap);
+    while (ix->slots[j].id && ix->slots[j].id != id) j = (j + 1) & mask;
+    if (!ix->slots[j].id) return;
+    ix->slots[j].id = 0;
+    ix->count--;
+    for (unsigned k = (j + 1) & mask; ix->slots[k].id; k = (k + 1) & mask) {
+        unsigned home = order_slot(ix->slots[k].id, ix->cap);
+        // move k back into the hole if its home is not in (j, k]
+        if (((k - home) & mask) >= ((k - j) & mask)) {
+            ix->slots[j] = ix->slots[k];
+            ix->slots[k].id = 0;
+            j = k;
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Journal: cada operación que cambia el estado (recepción, pedido, baja,
+// cancelación, purga) se agrega como una línea en la sintaxis del modo batch.
+// Recuperar = cargar el último snapshot y re-ejecutar el journal.
+// ---------------------------------------------------------------------------
+
+typedef struct Journal {
+    FILE *fp;          // NULL = journaling off
+    int suspended;     // set while replaying so records are not duplicated
+    long long records;
+    int scope;         // product of the last PRODUCT line (-1 all, JOURNAL_SCOPE_UNKNOWN)
+} Journal;
+
+#define JOURNAL_SCOPE_UNKNOWN -2
+
+Journal journal;
+
+int journal_on(void) { return journal.fp && !journal.suspended; }
+
+void journal_recv(int date, int stock, int product_id) {
+    if (!journal_on()) return;
+    fprintf(journal.fp, "RECV %d %d %s\n", date, stock, intern_name(product_id));
+    journal.records++;
+}
+
+// ORDER, ENQUEUE, DROP, EXPIRE and RETIRE act on the current product scope: emit a
+// PRODUCT line first whenever the scope changes (-1 = all products)
+void journal_scope(int product_id) {
+    if (!journal_on() || journal.scope == product_id) return;
+    if (product_id < 0) fputs("PRODUCT\n", journal.fp);
+    else fprintf(journal.fp, "PRODUCT %s\n", intern_name(product_id));
+    journal.scope = product_id;
+    journal.records++;
+}
+
+void journal_order(const char *dest, int qty) {
+    if (!journal_on()) return;
+    fprintf(journal.fp, "ORDER %s %d\n", dest, qty);
+    journal.records++;
+}
+
+void journal_enqueue(int date, const char *dest, int qty) {
+    if (!journal_on()) return;
+    fprintf(journal.fp, "ENQUEUE %d %s %d\n", date, dest, qty);
+    journal.records++;
+}
+
+// DROP, CANCELID, EXPIRE and CLOCK all take a single integer
+void journal_int(const char *cmd, int value) {
+    if (!journal_on()) return;
+    fprintf(journal.fp, "%s %d\n", cmd, value);
+    journal.records++;
+}
+
+// One step of the expiry sweep: `count` orders of the lot handled
+void journal_retire(int date, int count) {
+    if (!journal_on()) return;
+    fprintf(journal.fp, "RETIRE %d %d\n", date, count);
+    journal.records++;
+}
+
+void journal_flush(void) {
+    if (journal.fp) fflush(journal.fp);
+}
+
 int max(int a, int b) { return (a > b) ? a : b; }
 
 int height(AVLNode *n) { return n ? n->height : 0; }
+long long total_stock(AVLNode *n) { return n ? n->total_stock : 0; }
+long long total_orders(AVLNode *n) { return n ? n->total_orders : 0; }
+int total_lots(AVLNode *n) { return n ? n->total_lots : 0; }
+int max_stock(AVLNode *n) { return n ? n->max_stock : 0; }
 
-AVLNode *new_node(int date, const char *product, int stock) {
-    AVLNode *node = malloc(sizeof(AVLNode));
+// Stock of one lot; intake_order may change it concurrently under the read lock
+int lot_stock(AVLNode *n) {
+#ifdef CONCURRENT_INTAKE
+    return __atomic_load_n(&n->stock, __ATOMIC_RELAXED);
+#else
+    return n->stock;
+#endif
+}
+
+// Recompute height and subtree aggregates from the children, and adopt them
+void update_node(AVLNode *n) {
+    AVLNode *l = n->left, *r = n->right;
+    n->height = 1 + max(height(l), height(r));
+    n->total_stock = n->stock + total_stock(l) + total_stock(r);
+    n->total_orders = n->order_count + total_orders(l) + total_orders(r);
+    n->total_lots = 1 + total_lots(l) + total_lots(r);
+    n->max_stock = max(n->stock, max(max_stock(l), max_stock(r)));
+    if (l) l->parent = n;
+    if (r) r->parent = n;
+}
+
+// A lot's stock or queue changed: refresh aggregates up to the root, O(log n)
+void refresh_path(AVLNode *n) {
+    for (; n; n = n->parent) {
+        n->total_stock = n->stock + total_stock(n->left) + total_stock(n->right);
+        n->total_orders = n->order_count + total_orders(n->left) + total_orders(n->right);
+        n->max_stock = max(n->stock, max(max_stock(n->left), max_stock(n->right)));
+    }
+}
+
+AVLNode *new_node_id(int date, int product_id, int stock) {
+    AVLNode *node = pool_alloc(&node_pool);
     if (!node) return NULL;
     node->date = date;
-    node->product = strdup_alloc(product);
+    node->product_id = product_id;
     node->stock = stock;
     node->head = node->tail = NULL;
     node->left = node->right = NULL;
-    node->height = 1;
+    node->prev_lot = node->next_lot = NULL;
+    node->parent = NULL;
+    node->order_count = 0;
+#ifdef CONCURRENT_INTAKE
+    node->inbox = NULL;
+    node->dirty_next = NULL;
+#endif
+    update_node(node);
     return node;
 }
 
-Order *new_order(const char *dest, int qty) {
-    Order *o = malloc(sizeof(Order));
-    if (!o) return NULL;
-    o->destination = strdup_alloc(dest);
-    o->quantity = qty;
-    o->next = NULL;
-    return o;
+AVLNode *new_node(int date, const char *product, int stock) {
+    return new_node_id(date, intern(product), stock);
+}
+
+// Append an order to the lot's FIFO, in a new block if the last one is full;
+// returns its block (position in *slot) or NULL if out of memory
+OrderChunk *queue_push(AVLNode *lot, int id, int dest_id, int qty, long long created_ns, int *slot) {
+    OrderChunk *c = lot->tail;
+    if (!c || c->end == ORDER_CHUNK) {
+        c = pool_alloc(&chunk_pool);
+        if (!c) return NULL;
+        c->lot = lot;
+        c->begin = c->end = c->live = 0;
+        c->next = NULL;
+        c->prev = lot->tail;
+        if (lot->tail) lot->tail->next = c;
+        else lot->head = c;
+        lot->tail = c;
+    }
+    int i = c->end++;
+    c->id[i] = id;
+    c->dest_id[i] = dest_id;
+    c->quantity[i] = qty;
+    c->created_ns[i] = created_ns;
+    c->live++;
+    lot->order_count++;
+    *slot = i;
+    return c;
+}
+
+// Take the order at slot i out of its lot's FIFO; the slot becomes a hole
+// (trimmed at either end) and the block is released once it is empty
+void queue_remove(OrderChunk *c, int i) {
+    AVLNode *lot = c->lot;
+    c->id[i] = 0;
+    lot->order_count--;
+    if (--c->live == 0) {
+        if (c->prev) c->prev->next = c->next;
+        else lot->head = c->next;
+        if (c->next) c->next->prev = c->prev;
+        else lot->tail = c->prev;
+        pool_free(&chunk_pool, c);
+        return;
+    }
+    while (!c->id[c->begin]) c->begin++;
+    while (!c->id[c->end - 1]) c->end--;
 }
 
-void free_order_list(Order *head) {
+// Release a whole queue, one block (up to ORDER_CHUNK orders) at a time
+void free_order_list(OrderChunk *head) {
     while (head) {
-        Order *t = head;
+        OrderChunk *c = head;
         head = head->next;
-        free(t->destination);
-        free(t);
+        for (int i = c->begin; i < c->end; i++)
+            if (c->id[i]) order_index_remove(c->id[i]);
+        pool_free(&chunk_pool, c);
     }
 }
 
+// Lot list: every node is linked to its in-order predecessor/successor so
+// date-ordered walks never descend from the root again.
+void link_lot_before(AVLNode *n, AVLNode *succ) {
+    n->next_lot = succ;
+    n->prev_lot = succ->prev_lot;
+    if (n->prev_lot) n->prev_lot->next_lot = n;
+    succ->prev_lot = n;
+}
+
+void link_lot_after(AVLNode *n, AVLNode *pred) {
+    n->prev_lot = pred;
+    n->next_lot = pred->next_lot;
+    if (n->next_lot) n->next_lot->prev_lot = n;
+    pred->next_lot = n;
+}
+
+void unlink_lot(AVLNode *n) {
+    if (n->prev_lot) n->prev_lot->next_lot = n->next_lot;
+    if (n->next_lot) n->next_lot->prev_lot = n->prev_lot;
+    n->prev_lot = n->next_lot = NULL;
+}
+
 AVLNode *rotate_right(AVLNode *y) {
     AVLNode *x = y->left;
     AVLNode *T2 = x->right;
+    tree_stats.rotations++;
     x->right = y;
     y->left = T2;
-    y->height = max(height(y->left), height(y->right)) + 1;
-    x->height = max(height(x->left), height(x->right)) + 1;
+    x->parent = y->parent;
+    update_node(y);
+    update_node(x);
     return x;
 }
 
 AVLNode *rotate_left(AVLNode *x) {
     AVLNode *y = x->right;
     AVLNode *T2 = y->left;
+    tree_stats.rotations++;
     y->left = x;
     x->right = T2;
-    x->height = max(height(x->left), height(x->right)) + 1;
-    y->height = max(height(y->left), height(y->right)) + 1;
+    y->parent = x->parent;
+    update_node(x);
+    update_node(y);
     return y;
 }
 
@@ -103,21 +721,51 @@ int get_balance(AVLNode *n) {
     return height(n->left) - height(n->right);
 }
 
+// Restore the AVL property at n after one of its subtrees changed height
+AVLNode *rebalance(AVLNode *root) {
+    update_node(root);
+    int balance = get_balance(root);
+
+    // LL
+    if (balance > 1 && get_balance(root->left) >= 0)
+        return rotate_right(root);
+    // LR
+    if (balance > 1 && get_balance(root->left) < 0) {
+        root->left = rotate_left(root->left);
+        return rotate_right(root);
+    }
+    // RR
+    if (balance < -1 && get_balance(root->right) <= 0)
+        return rotate_left(root);
+    // RL
+    if (balance < -1 && get_balance(root->right) > 0) {
+        root->right = rotate_right(root->right);
+        return rotate_left(root);
+    }
+
+    return root;
+}
+
 AVLNode *insert_avl(AVLNode *node, int date, const char *product, int stock, int *inserted) {
     if (!node) {
         *inserted = 1;
         return new_node(date, product, stock);
     }
-    if (date < node->date)
+    tree_stats.comparisons++;
+    if (date < node->date) {
+        int leaf_slot = !node->left;
         node->left = insert_avl(node->left, date, product, stock, inserted);
-    else if (date > node->date)
+        if (leaf_slot && *inserted) link_lot_before(node->left, node);
+    } else if (date > node->date) {
+        int leaf_slot = !node->right;
         node->right = insert_avl(node->right, date, product, stock, inserted);
-    else {
+        if (leaf_slot && *inserted) link_lot_after(node->right, node);
+    } else {
         *inserted = 0; // duplicate date
         return node;
     }
 
-    node->height = 1 + max(height(node->left), height(node->right));
+    update_node(node);
     int balance = get_balance(node);
 
     // LL
@@ -147,8 +795,22 @@ AVLNode *min_value_node(AVLNode *node) {
     return current;
 }
 
+// Detach the minimum node of t; returns the rebalanced remainder
+AVLNode *detach_min(AVLNode *t, AVLNode **min) {
+    if (!t->left) {
+        *min = t;
+        if (t->right) t->right->parent = t->parent;
+        return t->right;
+    }
+    t->left = detach_min(t->left, min);
+    return rebalance(t);
+}
+
+// Delete by relinking: the successor node itself moves into the deleted
+// node's place, so no product, queue or node content is ever copied.
 AVLNode *delete_avl(AVLNode *root, int date, int *deleted) {
     if (!root) return root;
+    tree_stats.comparisons++;
     if (date < root->date)
         root->left = delete_avl(root->left, date, deleted);
     else if (date > root->date)
@@ -156,122 +818,191 @@ AVLNode *delete_avl(AVLNode *root, int date, int *deleted) {
     else {
         // found
         *deleted = 1;
+        unlink_lot(root);
         // free queue
         free_order_list(root->head);
-        free(root->product);
-        // node with one or no child
-        if (!root->left || !root->right) {
-            AVLNode *temp = root->left ? root->left : root->right;
-            if (!temp) {
-                temp = root;
-                root = NULL;
-            } else {
-                *root = *temp; // copy content
-            }
-            free(temp);
-        } else {
-            AVLNode *temp = min_value_node(root->right);
-            // copy data
-            free(root->product);
-            root->date = temp->date;
-            root->product = strdup_alloc(temp->product);
-            root->stock = temp->stock;
-            // free old queue and duplicate successor's queue
-            free_order_list(root->head);
-            // Duplicate queue
-            root->head = root->tail = NULL;
-            for (Order *it = temp->head; it; it = it->next) {
-                Order *n = new_order(it->destination, it->quantity);
-                if (!root->head) root->head = root->tail = n;
-                else { root->tail->next = n; root->tail = n; }
-            }
-            root->right = delete_avl(root->right, temp->date, deleted); // will delete successor
+        AVLNode *left = root->left, *right = root->right, *parent = root->parent;
+        pool_free(&node_pool, root);
+        // node with one or no child: the child takes its place
+        if (!left || !right) {
+            AVLNode *child = left ? left : right;
+            if (child) child->parent = parent;
+            return child;
         }
+        // two children: splice the in-order successor in
+        AVLNode *succ;
+        AVLNode *rest = detach_min(right, &succ);
+        succ->left = left;
+        succ->right = rest;
+        succ->parent = parent;
+        return rebalance(succ);
     }
+    return rebalance(root);
+}
 
-    if (!root) return root;
-
-    root->height = 1 + max(height(root->left), height(root->right));
-    int balance = get_balance(root);
-
-    // LL
-    if (balance > 1 && get_balance(root->left) >= 0)
-        return rotate_right(root);
-    // LR
-    if (balance > 1 && get_balance(root->left) < 0) {
-        root->left = rotate_left(root->left);
-        return rotate_right(root);
+// Join two trees through a middle node k: every date in l < k->date < every date in r
+AVLNode *join_avl(AVLNode *l, AVLNode *k, AVLNode *r) {
+    if (height(l) > height(r) + 1) {
+        l->right = join_avl(l->right, k, r);
+        return rebalance(l);
     }
-    // RR
-    if (balance < -1 && get_balance(root->right) <= 0)
-        return rotate_left(root);
-    // RL
-    if (balance < -1 && get_balance(root->right) > 0) {
-        root->right = rotate_right(root->right);
-        return rotate_left(root);
+    if (height(r) > height(l) + 1) {
+        r->left = join_avl(l, k, r->left);
+        return rebalance(r);
     }
+    k->left = l;
+    k->right = r;
+    update_node(k);
+    return k;
+}
 
-    return root;
+// Split t into lots with date < key (*lo) and date >= key (*hi) in O(log n)
+void split_avl(AVLNode *t, int key, AVLNode **lo, AVLNode **hi) {
+    if (!t) { *lo = *hi = NULL; return; }
+    AVLNode *l = t->left, *r = t->right, *a, *b;
+    if (t->date < key) {
+        split_avl(r, key, &a, &b);
+        *lo = join_avl(l, t, a);
+        *hi = b;
+    } else {
+        split_avl(l, key, &a, &b);
+        *lo = a;
+        *hi = join_avl(b, t, r);
+    }
+    if (*lo) (*lo)->parent = NULL;
+    if (*hi) (*hi)->parent = NULL;
 }
 
 AVLNode *find_node(AVLNode *root, int date) {
     if (!root) return NULL;
+    tree_stats.comparisons++;
     if (date == root->date) return root;
     if (date < root->date) return find_node(root->left, date);
     return find_node(root->right, date);
 }
 
-// Enqueue order at specific node
+// First lot with date >= key (NULL if none), O(log n)
+AVLNode *lower_bound_node(AVLNode *root, int key) {
+    AVLNode *best = NULL;
+    while (root) {
+        tree_stats.comparisons++;
+        if (root->date >= key) { best = root; root = root->left; }
+        else root = root->right;
+    }
+    return best;
+}
+
+// Lot at 0-based position k in date order, from the subtree lot counts
+AVLNode *node_at_rank(AVLNode *root, long k) {
+    while (root) {
+        long left = total_lots(root->left);
+        if (k < left) root = root->left;
+        else if (k == left) return root;
+        else { k -= left + 1; root = root->right; }
+    }
+    return NULL;
+}
+
+// Aggregates over a date range, answered from subtree totals in O(log n)
+typedef struct RangeTotals {
+    long long stock;
+    long long orders;
+    int lots;
+} RangeTotals;
+
+// Totals over every lot with date < limit
+RangeTotals totals_before(AVLNode *root, int limit) {
+    RangeTotals t = {0, 0, 0};
+    while (root) {
+        if (root->date < limit) {
+            t.stock += total_stock(root->left) + lot_stock(root);
+            t.orders += total_orders(root->left) + root->order_count;
+            t.lots += total_lots(root->left) + 1;
+            root = root->right;
+        } else {
+            root = root->left;
+        }
+    }
+    return t;
+}
+
+// Totals over lots with from <= date <= to
+RangeTotals totals_between(AVLNode *root, int from, int to) {
+    RangeTotals t = {0, 0, 0};
+    if (!root || from > to) return t;
+    if (to == INT_MAX) {
+        t.stock = root->total_stock;
+        t.orders = root->total_orders;
+        t.lots = root->total_lots;
+    } else {
+        t = totals_before(root, to + 1);
+    }
+    RangeTotals lo = totals_before(root, from);
+    t.stock -= lo.stock;
+    t.orders -= lo.orders;
+    t.lots -= lo.lots;
+    return t;
+}
+
+// Enqueue order at specific node; returns the new order id (> 0),
+// -1 if the lot has insufficient stock, 0 on invalid input or no memory
 int enqueue_order(AVLNode *node, const char *dest, int qty) {
     if (!node) return 0;
     if (qty <= 0) return 0;
     if (node->stock < qty) return -1; // insufficient stock
-    Order *o = new_order(dest, qty);
-    if (!o) return 0;
-    if (!node->head) node->head = node->tail = o;
-    else { node->tail->next = o; node->tail = o; }
+    int dest_id = intern(dest);
+    if (dest_id < 0) return 0;
+    int id = order_index.next_id + 1, slot;
+    OrderChunk *c = queue_push(node, id, dest_id, qty, stats_now_ns(), &slot);
+    if (!c) return 0;
+    if (!order_index_add(id, c, slot)) { queue_remove(c, slot); return 0; }
+    order_index.next_id = id;
     node->stock -= qty;
+    refresh_path(node);
+    return id;
+}
+
+// Take an order out of its lot queue and restore the stock it reserved
+void remove_order(OrderChunk *c, int slot) {
+    AVLNode *node = c->lot;
+    int id = c->id[slot];
+    node->stock += c->quantity[slot];
+    queue_remove(c, slot);
+    refresh_path(node);
+    order_index_remove(id);
+}
+
+// Cancel an order by id in O(1); returns 1 if it existed
+int cancel_order_by_id(int id) {
+    OrderRef *r = order_index_find(id);
+    if (!r) return 0;
+    remove_order(r->chunk, r->slot);
+    journal_int("CANCELID", id);
     return 1;
 }
 
 // Cancel specific order from a node's queue by matching destination and quantity (first match)
 int cancel_order_in_node(AVLNode *node, const char *dest, int qty) {
     if (!node || !node->head) return 0;
-    Order *prev = NULL;
-    Order *it = node->head;
-    while (it) {
-        if (strcmp(it->destination, dest) == 0 && it->quantity == qty) {
-            if (prev) prev->next = it->next;
-            else node->head = it->next;
-            if (it == node->tail) node->tail = prev;
-            node->stock += it->quantity;
-            free(it->destination);
-            free(it);
-            return 1;
+    int dest_id = intern_find(dest);
+    if (dest_id < 0) return 0; // destination never used by any order
+    for (OrderChunk *c = node->head; c; c = c->next) {
+        for (int i = c->begin; i < c->end; i++) {
+            if (c->id[i] && c->dest_id[i] == dest_id && c->quantity[i] == qty) {
+                journal_int("CANCELID", c->id[i]);
+                remove_order(c, i);
+                return 1;
+            }
         }
-        prev = it;
-        it = it->next;
     }
     return 0;
 }
 
 // Count orders
-int count_orders(Order *head) {
-    int c = 0;
-    while (head) { c++; head = head->next; }
-    return c;
-}
-
-// Report: in-order from smallest date (closest to expire)
-void report_inorder(AVLNode *root) {
-    if (!root) return;
-    report_inorder(root->left);
-    int y = root->date / 10000;
-    int m = (root->date / 100) % 100;
-    int d = root->date % 100;
-    printf("Fecha: %04d-%02d-%02d | Producto: %s | Stock: %d | Pedidos en espera: %d\n",
-           y, m, d, root->product, root->stock, count_orders(root->head));
-    report_inorder(root->right);
+int count_orders(OrderChunk *head) {
+    int n = 0;
+    for (; head; head = head->next) n += head->live;
+    return n;
 }
 
 // Free whole tree
@@ -280,92 +1011,3084 @@ void free_tree(AVLNode *root) {
     free_tree(root->left);
     free_tree(root->right);
     free_order_list(root->head);
-    free(root->product);
-    free(root);
+    pool_free(&node_pool, root);
 }
 
-// Helper to read string with spaces
-void read_line(char *buf, int size) {
-    if (!fgets(buf, size, stdin)) { buf[0] = '\0'; return; }
-    size_t len = strlen(buf);
-    if (len && buf[len-1] == '\n') buf[len-1] = '\0';
+// ---------------------------------------------------------------------------
+// Índice B+ de lotes: fechas empaquetadas de forma contigua en cada nodo
+// (una o dos líneas de caché por nivel en lugar de un fallo por nivel del AVL)
+// y hojas encadenadas para recorridos en orden. Compilando con
+// -DLOT_INDEX_BTREE el inventario lo usa para buscar lotes por fecha y para
+// los reportes en orden; el AVL sigue manteniendo los agregados.
+// Al borrar no se redistribuye entre hermanos: un nodo solo se libera cuando
+// queda vacío. A cambio, cuando las hojas quedan en promedio por debajo de un
+// cuarto de su capacidad (BT_SPARSE) el índice se reconstruye compacto desde
+// la cadena de hojas, O(n) amortizado sobre las bajas que lo vaciaron. Los
+// vencimientos quitan un prefijo de fechas entero con btree_delete_below.
+// ---------------------------------------------------------------------------
+
+#define BT_ORDER 32 // max keys per node
+#define BT_SPARSE 4 // rebuild when leaves hold under 1/BT_SPARSE of their room
+
+typedef struct BTNode {
+    int count;                      // keys in use
+    int leaf;
+    int keys[BT_ORDER + 1];         // one spare slot before a split
+    void *ptr[BT_ORDER + 2];        // leaf: AVLNode* per key; inner: children
+    struct BTNode *next, *prev;     // leaf chain
+} BTNode;
+
+typedef struct BTree {
+    BTNode *root;
+    BTNode *first; // leftmost leaf
+    int height;
+    long count;
+    long leaves;
+} BTree;
+
+Pool btnode_pool = { .obj_size = sizeof(BTNode) };
+
+BTNode *bt_new(int leaf) {
+    BTNode *n = pool_alloc(&btnode_pool);
+    if (!n) return NULL;
+    n->count = 0;
+    n->leaf = leaf;
+    n->next = n->prev = NULL;
+    return n;
 }
 
-void pause() { printf("Presiona ENTER para continuar...\n"); getchar(); }
+// Number of keys <= key: child slot in an inner node
+int bt_upper(const BTNode *n, int key) {
+    int i = 0;
+    for (int k = 0; k < n->count; k++) i += n->keys[k] <= key;
+    return i;
+}
 
-int main() {
-    AVLNode *root = NULL;
-    int choice = 0;
-    char buf[256];
+// Number of keys < key: insert/match position in a leaf
+int bt_lower(const BTNode *n, int key) {
+    int i = 0;
+    for (int k = 0; k < n->count; k++) i += n->keys[k] < key;
+    return i;
+}
 
-    while (1) {
-        printf("\n--- Sistema Logístico - Puerto Buenaventura ---\n");
-        printf("1) Recepción de Mercancía (Insertar en AVL)\n");
-        printf("2) Registrar Pedido de Despacho (Encolar FIFO, lote más cercano a vencer)\n");
-        printf("3) Baja de Producto (Eliminar lote por fecha)\n");
-        printf("4) Cancelar Pedido (Eliminar pedido específico)\n");
-        printf("5) Reporte de Estado (In-Order)\n");
-        printf("6) Salir\n");
-        printf("Elija una opción: ");
-        if (!fgets(buf, sizeof(buf), stdin)) break;
-        choice = atoi(buf);
-        if (choice == 1) {
-            printf("Ingrese fecha de vencimiento (AAAAMMDD): ");
-            int date; if (scanf("%d", &date) != 1) { while(getchar()!='\n'); printf("Entrada inválida.\n"); continue; }
-            while(getchar()!='\n');
-            printf("Ingrese cantidad (stock): "); int qty; if (scanf("%d", &qty) != 1) { while(getchar()!='\n'); printf("Entrada inválida.\n"); continue; }
-            while(getchar()!='\n');
-            printf("Ingrese nombre del producto: "); read_line(buf, sizeof(buf));
-            int inserted = 0;
-            root = insert_avl(root, date, buf, qty, &inserted);
-            if (!inserted) printf("Error: ya existe un lote con esa fecha, no se puede procesar.\n");
-            else printf("Lote agregado correctamente.\n");
-        } else if (choice == 2) {
-            AVLNode *node = min_value_node(root);
-            if (!node) { printf("No hay lotes disponibles.\n"); continue; }
-            printf("Lote seleccionado: %s (Fecha %08d) Stock: %d\n", node->product, node->date, node->stock);
-            printf("Ingrese destino: "); read_line(buf, sizeof(buf));
-            printf("Ingrese cantidad solicitada: "); int qty; if (scanf("%d", &qty) != 1) { while(getchar()!='\n'); printf("Entrada inválida.\n"); continue; }
-            while(getchar()!='\n');
-            int res = enqueue_order(node, buf, qty);
-            if (res == -1) printf("No hay stock suficiente para ese pedido.\n");
-            else if (res == 1) printf("Pedido encolado correctamente.\n");
-            else printf("Error al encolar pedido.\n");
-        } else if (choice == 3) {
-            printf("Ingrese fecha del lote a eliminar (AAAAMMDD): "); int date; if (scanf("%d", &date) != 1) { while(getchar()!='\n'); printf("Entrada inválida.\n"); continue; }
-            while(getchar()!='\n');
-            int deleted = 0;
-            root = delete_avl(root, date, &deleted);
-            if (deleted) printf("Lote eliminado correctamente (se liberó su cola).\n");
-            else printf("No se encontró lote con esa fecha.\n");
-        } else if (choice == 4) {
-            printf("Ingrese fecha del lote donde está el pedido (AAAAMMDD): "); int date; if (scanf("%d", &date) != 1) { while(getchar()!='\n'); printf("Entrada inválida.\n"); continue; }
-            while(getchar()!='\n');
-            AVLNode *node = find_node(root, date);
-            if (!node) { printf("No se encontró lote con esa fecha.\n"); continue; }
-            printf("Pedidos actuales en ese lote:\n");
-            int idx = 1;
-            for (Order *it = node->head; it; it = it->next) {
-                printf("%d) Destino: %s | Cantidad: %d\n", idx++, it->destination, it->quantity);
-            }
-            if (!node->head) { printf("No hay pedidos en ese lote.\n"); continue; }
+AVLNode *btree_find(const BTree *t, int key) {
+    const BTNode *n = t->root;
+    if (!n) return NULL;
+    while (!n->leaf) n = n->ptr[bt_upper(n, key)];
+    int i = bt_lower(n, key);
+    return (i < n->count && n->keys[i] == key) ? n->ptr[i] : NULL;
+}
+
+// Leaf position of the first key >= key; (NULL, 0) on an empty tree. The
+// position may be one past the leaf's last key, scans move on to the next leaf
+void btree_seek(const BTree *t, int key, BTNode **leaf, int *pos) {
+    BTNode *n = t->root;
+    *leaf = NULL;
+    *pos = 0;
+    if (!n) return;
+    while (!n->leaf) n = n->ptr[bt_upper(n, key)];
+    *leaf = n;
+    *pos = bt_lower(n, key);
+}
+
+AVLNode *btree_min(const BTree *t) {
+    return t->first && t->first->count ? t->first->ptr[0] : NULL;
+}
+
+// Split an overfull node; returns the new right sibling and its separator
+BTNode *bt_split(BTNode *n, int *sep) {
+    BTNode *r = bt_new(n->leaf);
+    if (!r) return NULL;
+    int mid = n->count / 2;
+    if (n->leaf) {
+        r->count = n->count - mid;
+        memcpy(r->keys, n->keys + mid, sizeof(int) * (size_t)r->count);
+        memcpy(r->ptr, n->ptr + mid, sizeof(void *) * (size_t)r->count);
+        n->count = mid;
+        r->next = n->next;
+        r->prev = n;
+        if (n->next) n->next->prev = r;
+        n->next = r;
+        *sep = r->keys[0];
+    } else {
+        *sep = n->keys[mid];
+        r->count = n->count - mid - 1;
+        memcpy(r->keys, n->keys + mid + 1, sizeof(int) * (size_t)r->count);
+        memcpy(r->ptr, n->ptr + mid + 1, sizeof(void *) * (size_t)(r->count + 1));
+        n->count = mid;
+    }
+    return r;
+}
+
+// Returns 1 if inserted, 0 if key exists, -1 if out of memory; *split gets a
+// new right sibling when n overflowed
+int bt_insert_rec(BTree *t, BTNode *n, int key, AVLNode *lot, BTNode **split, int *sep) {
+    *split = NULL;
+    int i;
+    if (n->leaf) {
+        i = bt_lower(n, key);
+        if (i < n->count && n->keys[i] == key) return 0;
+        memmove(n->keys + i + 1, n->keys + i, sizeof(int) * (size_t)(n->count - i));
+        memmove(n->ptr + i + 1, n->ptr + i, sizeof(void *) * (size_t)(n->count - i));
+        n->keys[i] = key;
+        n->ptr[i] = lot;
+        n->count++;
+    } else {
+        i = bt_upper(n, key);
+        BTNode *child_split;
+        int child_sep;
+        int rc = bt_insert_rec(t, n->ptr[i], key, lot, &child_split, &child_sep);
+        if (rc <= 0 || !child_split) return rc;
+        memmove(n->keys + i + 1, n->keys + i, sizeof(int) * (size_t)(n->count - i));
+        memmove(n->ptr + i + 2, n->ptr + i + 1, sizeof(void *) * (size_t)(n->count - i));
+        n->keys[i] = child_sep;
+        n->ptr[i + 1] = child_split;
+        n->count++;
+    }
+    if (n->count > BT_ORDER) {
+        *split = bt_split(n, sep);
+        if (!*split) return -1;
+        if (n->leaf) t->leaves++;
+    }
+    return 1;
+}
+
+int btree_insert(BTree *t, int key, AVLNode *lot) {
+    if (!t->root) {
+        t->root = t->first = bt_new(1);
+        if (!t->root) return -1;
+        t->height = 1;
+        t->leaves = 1;
+    }
+    BTNode *split;
+    int sep;
+    int rc = bt_insert_rec(t, t->root, key, lot, &split, &sep);
+    if (split) {
+        BTNode *root = bt_new(0);
+        if (!root) return -1;
+        root->count = 1;
+        root->keys[0] = sep;
+        root->ptr[0] = t->root;
+        root->ptr[1] = split;
+        t->root = root;
+        t->height++;
+    }
+    if (rc > 0) t->count++;
+    return rc;
+}
+
+// Returns 1 if n became empty and was released
+int bt_delete_rec(BTree *t, BTNode *n, int key, int *deleted) {
+    if (n->leaf) {
+        int i = bt_lower(n, key);
+        if (i == n->count || n->keys[i] != key) return 0;
+        *deleted = 1;
+        memmove(n->keys + i, n->keys + i + 1, sizeof(int) * (size_t)(n->count - i - 1));
+        memmove(n->ptr + i, n->ptr + i + 1, sizeof(void *) * (size_t)(n->count - i - 1));
+        if (--n->count > 0) return 0;
+        if (n->prev) n->prev->next = n->next;
+        else t->first = n->next;
+        if (n->next) n->next->prev = n->prev;
+        pool_free(&btnode_pool, n);
+        t->leaves--;
+        return 1;
+    }
+    int i = bt_upper(n, key);
+    if (!bt_delete_rec(t, n->ptr[i], key, deleted)) return 0;
+    // drop the empty child and the separator next to it
+    if (n->count == 0) {
+        pool_free(&btnode_pool, n);
+        return 1;
+    }
+    int k = i > 0 ? i - 1 : 0;
+    memmove(n->keys + k, n->keys + k + 1, sizeof(int) * (size_t)(n->count - k - 1));
+    memmove(n->ptr + i, n->ptr + i + 1, sizeof(void *) * (size_t)(n->count - i));
+    n->count--;
+    return 0;
+}
+
+void bt_free_rec(BTNode *n) {
+    if (!n->leaf)
+        for (int i = 0; i <= n->count; i++) bt_free_rec(n->ptr[i]);
+    pool_free(&btnode_pool, n);
+}
+
+void btree_free(BTree *t) {
+    if (t->root) bt_free_rec(t->root);
+    memset(t, 0, sizeof(*t));
+}
+
+// Release a whole subtree that is being cut out of t, keeping count and
+// leaves in step (the leaf chain is fixed by the caller)
+void bt_drop_rec(BTree *t, BTNode *n) {
+    if (n->leaf) {
+        t->count -= n->count;
+        t->leaves--;
+    } else {
+        for (int i = 0; i <= n->count; i++) bt_drop_rec(t, n->ptr[i]);
+    }
+    pool_free(&btnode_pool, n);
+}
+
+// Collapse inner roots left with a single child; empty tree if root is gone
+void bt_shrink_root(BTree *t) {
+    if (!t->root) {
+        t->first = NULL;
+        t->height = 0;
+        return;
+    }
+    while (!t->root->leaf && t->root->count == 0) {
+        BTNode *old = t->root;
+        t->root = old->ptr[0];
+        pool_free(&btnode_pool, old);
+        t->height--;
+    }
+}
+
+// A build ran out of memory: every node made so far hangs from level[0..done)
+// (finished nodes of the current level) or level[from..nodes) (the lower
+// level's nodes not yet given a parent)
+int bt_build_abort(BTNode **level, long done, long from, long nodes, int *mins) {
+    for (long i = 0; i < done; i++) bt_free_rec(level[i]);
+    for (long i = from; i < nodes; i++) bt_free_rec(level[i]);
+    free(level);
+    free(mins);
+    return 0;
+}
+
+// Build from lots already sorted by date: full leaves, then inner levels.
+// Replaces t only on success; returns 0 (t untouched) when out of memory.
+int btree_build(BTree *t, AVLNode **lots, long n) {
+    BTree b = {0};
+    if (n == 0) { btree_free(t); return 1; }
+    long nodes = (n + BT_ORDER - 1) / BT_ORDER;
+    BTNode **level = malloc(sizeof(BTNode *) * (size_t)nodes);
+    int *mins = malloc(sizeof(int) * (size_t)nodes);
+    if (!level || !mins) { free(level); free(mins); return 0; }
+    BTNode *prev = NULL;
+    for (long i = 0; i < nodes; i++) {
+        BTNode *leaf = bt_new(1);
+        if (!leaf) return bt_build_abort(level, i, nodes, nodes, mins);
+        long from = i * BT_ORDER;
+        for (long k = from; k < n && k < from + BT_ORDER; k++) {
+            leaf->keys[leaf->count] = lots[k]->date;
+            leaf->ptr[leaf->count++] = lots[k];
+        }
+        leaf->prev = prev;
+        if (prev) prev->next = leaf;
+        else b.first = leaf;
+        prev = leaf;
+        level[i] = leaf;
+        mins[i] = leaf->keys[0];
+    }
+    b.height = 1;
+    b.leaves = nodes;
+    while (nodes > 1) {
+        long parents = (nodes + BT_ORDER) / (BT_ORDER + 1);
+        for (long i = 0; i < parents; i++) {
+            BTNode *inner = bt_new(0);
+            if (!inner) return bt_build_abort(level, i, i * (BT_ORDER + 1), nodes, mins);
+            long from = i * (BT_ORDER + 1);
+            long to = from + BT_ORDER + 1 < nodes ? from + BT_ORDER + 1 : nodes;
+            inner->ptr[0] = level[from];
+            for (long k = from + 1; k < to; k++) {
+                inner->keys[inner->count] = mins[k];
+                inner->ptr[++inner->count] = level[k];
+            }
+            int min = mins[from];
+            level[i] = inner;
+            mins[i] = min;
+        }
+        nodes = parents;
+        b.height++;
+    }
+    b.root = level[0];
+    b.count = n;
+    free(level);
+    free(mins);
+    btree_free(t);
+    *t = b;
+    return 1;
+}
+
+// Rebuild t packed once its leaves are mostly empty. Failure only means the
+// index stays sparse, so it is ignored.
+void bt_compact(BTree *t) {
+    if (t->leaves < 2 || t->count * BT_SPARSE >= t->leaves * BT_ORDER) return;
+    AVLNode **lots = malloc(sizeof(AVLNode *) * (size_t)t->count);
+    if (!lots) return;
+    long n = 0;
+    for (BTNode *leaf = t->first; leaf; leaf = leaf->next)
+        for (int i = 0; i < leaf->count; i++) lots[n++] = leaf->ptr[i];
+    btree_build(t, lots, n);
+    free(lots);
+}
+
+int btree_delete(BTree *t, int key) {
+    int deleted = 0;
+    if (!t->root) return 0;
+    if (bt_delete_rec(t, t->root, key, &deleted)) t->root = NULL;
+    bt_shrink_root(t);
+    if (deleted) {
+        t->count--;
+        bt_compact(t);
+    }
+    return deleted;
+}
+
+// Remove every key < limit from the subtree; returns 1 if n became empty and
+// was released. Whole children below limit are dropped without a search.
+int bt_delete_below(BTree *t, BTNode *n, int limit) {
+    if (n->leaf) {
+        int i = bt_lower(n, limit);
+        if (i == 0) return 0;
+        t->count -= i;
+        n->count -= i;
+        if (n->count > 0) {
+            memmove(n->keys, n->keys + i, sizeof(int) * (size_t)n->count);
+            memmove(n->ptr, n->ptr + i, sizeof(void *) * (size_t)n->count);
+            return 0;
+        }
+        pool_free(&btnode_pool, n);
+        t->leaves--;
+        return 1;
+    }
+    // children before slot i hold only keys < keys[i-1] <= limit
+    int i = bt_upper(n, limit);
+    for (int k = 0; k < i; k++) bt_drop_rec(t, n->ptr[k]);
+    int gone = i + bt_delete_below(t, n->ptr[i], limit);
+    if (gone > n->count) {
+        pool_free(&btnode_pool, n);
+        return 1;
+    }
+    // the first remaining child loses the separator before it
+    n->count -= gone;
+    memmove(n->keys, n->keys + gone, sizeof(int) * (size_t)n->count);
+    memmove(n->ptr, n->ptr + gone, sizeof(void *) * (size_t)(n->count + 1));
+    return 0;
+}
+
+// Remove every key < limit (a prefix of the leaf chain); returns the keys removed
+long btree_delete_below(BTree *t, int limit) {
+    if (!t->root) return 0;
+    long before = t->count;
+    if (bt_delete_below(t, t->root, limit)) t->root = NULL;
+    bt_shrink_root(t);
+    if (t->root) {
+        BTNode *n = t->root;
+        while (!n->leaf) n = n->ptr[0];
+        n->prev = NULL;
+        t->first = n;
+    }
+    if (t->count < before) bt_compact(t);
+    return before - t->count;
+}
+
+// Return all slabs and arena blocks to the heap (end of program / batch)
+void memory_release(void) {
+#ifdef CONCURRENT_INTAKE
+    pool_adopt(&order_pool, &intake_pool);
+#endif
+    pool_destroy(&node_pool);
+    pool_destroy(&chunk_pool);
+#ifdef CONCURRENT_INTAKE
+    pool_destroy(&order_pool);
+#endif
+    arena_destroy(&string_arena);
+    free(strings.names);
+    free(strings.hashes);
+    free(strings.slots);
+    memset(&strings, 0, sizeof(strings));
+    free(order_index.slots);
+    memset(&order_index, 0, sizeof(order_index));
+    pool_destroy(&btnode_pool);
+}
+
+// ---------------------------------------------------------------------------
+// Inventario: raíz del AVL más la lista de lotes en orden de fecha. El
+// centinela `lots` cierra la lista circular, así el lote más próximo a vencer
+// es siempre lots.next_lot (O(1)) y sigue válido tras rotaciones y bajas.
+// ---------------------------------------------------------------------------
+
+typedef struct Inventory {
+    AVLNode *root;
+    AVLNode lots; // sentinel: lots.next_lot = earliest, lots.prev_lot = latest
+    int lot_count;
+    int product_id; // product of this catalog shard, -1 for a standalone inventory
+#ifdef LOT_INDEX_BTREE
+    BTree index;  // date -> lot, used for lookups and in-order scans
+#endif
+} Inventory;
+
+#ifdef LOT_INDEX_BTREE
+#define LOT_INDEX_NAME "btree"
+#else
+#define LOT_INDEX_NAME "avl"
+#endif
+
+// Expiry clock: lots dated before `today` (AAAAMMDD) are expired and take no
+// new orders; today is INT_MIN while no clock is set. The sweep that retires
+// expired lots runs after the dispatch stage (see expiry_tick).
+typedef struct ExpiryClock {
+    int today;
+    int real;            // follow the system date (--clock real)
+    int armed;           // some shard may still hold expired lots
+    int shard;           // catalog shard where the sweep resumes
+    long long checked_at; // seconds of the last system date read
+    long long retired, moved, failed, failed_units;
+    LatencyHist latency; // duration of the sweep steps that did work
+} ExpiryClock;
+
+ExpiryClock expiry = { .today = INT_MIN };
+
+// Lots may have expired (clock moved, past-dated lots loaded): sweep every shard again
+void expiry_rearm(void) {
+    expiry.armed = 1;
+    expiry.shard = 0;
+}
+
+#ifdef CONCURRENT_INTAKE
+// One lock for the whole store: inventories, catalog, order index, pools,
+// string table and id counter are all shared (see intake_order)
+pthread_rwlock_t store_lock; // shared: intake and reads; exclusive: everything else
+pthread_once_t store_lock_once = PTHREAD_ONCE_INIT;
+
+void store_lock_init(void) {
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+    // a steady stream of intake readers must not starve the draining writer
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init(&store_lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+}
+#endif
+
+void inventory_init(Inventory *inv) {
+    memset(inv, 0, sizeof(*inv));
+    inv->lots.next_lot = inv->lots.prev_lot = &inv->lots;
+    inv->product_id = -1;
+#ifdef CONCURRENT_INTAKE
+    pthread_once(&store_lock_once, store_lock_init);
+#endif
+}
+
+AVLNode *earliest_lot(Inventory *inv) {
+    return inv->lots.next_lot == &inv->lots ? NULL : inv->lots.next_lot;
+}
+
+// Lot after n in date order, or NULL at the end
+AVLNode *next_lot(Inventory *inv, AVLNode *n) {
+    return n->next_lot == &inv->lots ? NULL : n->next_lot;
+}
+
+// Earliest lot that has not expired: where FEFO allocation starts
+AVLNode *first_viable_lot(Inventory *inv) {
+    AVLNode *n = earliest_lot(inv);
+    return n && n->date < expiry.today ? lower_bound_node(inv->root, expiry.today) : n;
+}
+
+// Stock that can still be allocated: expired lots waiting to be retired do not count
+long long viable_stock(Inventory *inv) {
+    AVLNode *n = earliest_lot(inv);
+    long long stock = total_stock(inv->root);
+    return n && n->date < expiry.today ? stock - totals_before(inv->root, expiry.today).stock : stock;
+}
+
+AVLNode *inventory_find(Inventory *inv, int date) {
+#ifdef LOT_INDEX_BTREE
+    return btree_find(&inv->index, date);
+#else
+    return find_node(inv->root, date);
+#endif
+}
+
+// In-order scan over the lot index (leaf chain or lot list)
+typedef struct LotScan {
+    AVLNode *lot;
+    BTNode *leaf;
+    int pos;
+} LotScan;
+
+AVLNode *scan_next(Inventory *inv, LotScan *sc) {
+#ifdef LOT_INDEX_BTREE
+    (void)inv;
+    while (sc->leaf && sc->pos >= sc->leaf->count) {
+        sc->leaf = sc->leaf->next;
+        sc->pos = 0;
+    }
+    sc->lot = sc->leaf ? sc->leaf->ptr[sc->pos++] : NULL;
+#else
+    sc->lot = sc->lot ? next_lot(inv, sc->lot) : NULL;
+#endif
+    return sc->lot;
+}
+
+AVLNode *scan_first(Inventory *inv, LotScan *sc) {
+#ifdef LOT_INDEX_BTREE
+    sc->leaf = inv->index.first;
+    sc->pos = 0;
+    return scan_next(inv, sc);
+#else
+    sc->leaf = NULL;
+    sc->pos = 0;
+    return sc->lot = earliest_lot(inv);
+#endif
+}
+
+// Start (or resume) a scan at the first lot dated on or after date, O(log n);
+// the lot list then yields each following lot in O(1), no stack needed
+AVLNode *scan_from(Inventory *inv, LotScan *sc, int date) {
+#ifdef LOT_INDEX_BTREE
+    btree_seek(&inv->index, date, &sc->leaf, &sc->pos);
+    return scan_next(inv, sc);
+#else
+    sc->leaf = NULL;
+    sc->pos = 0;
+    return sc->lot = lower_bound_node(inv->root, date);
+#endif
+}
+
+// Receive a lot; returns 1 if inserted, 0 if its date already exists
+int inventory_receive(Inventory *inv, int date, const char *product, int stock) {
+    int inserted = 0;
+    int was_empty = inv->root == NULL;
+    inv->root = insert_avl(inv->root, date, product, stock, &inserted);
+    if (!inserted) return 0;
+    if (was_empty) link_lot_after(inv->root, &inv->lots);
+    inv->lot_count++;
+#ifdef LOT_INDEX_BTREE
+    // a failed split can leave the index half-updated (an overfull node), so
+    // there is no clean rollback: a lot missing from it would be lost silently
+    if (btree_insert(&inv->index, date, find_node(inv->root, date)) < 0) {
+        perror("btree_insert");
+        exit(EXIT_FAILURE);
+    }
+#endif
+    if (date < expiry.today) expiry_rearm();
+    journal_recv(date, stock, intern_find(product));
+    return 1;
+}
+
+// Remove a lot and its queue without journaling it; returns 1 if it existed
+int inventory_remove(Inventory *inv, int date) {
+    int deleted = 0;
+    inv->root = delete_avl(inv->root, date, &deleted);
+    if (deleted) {
+        inv->lot_count--;
+#ifdef LOT_INDEX_BTREE
+        btree_delete(&inv->index, date);
+#endif
+    }
+    return deleted;
+}
+
+// Drop a lot and its queue; returns 1 if it existed
+int inventory_drop(Inventory *inv, int date) {
+    int deleted = inventory_remove(inv, date);
+    if (deleted) {
+        journal_scope(inv->product_id);
+        journal_int("DROP", date);
+    }
+    return deleted;
+}
+
+// FEFO allocation: serve qty from the earliest-expiry lots in date order,
+// splitting it into one queued order per lot consumed; expired lots are
+// skipped. The order is all or nothing: returns the id of the first part
+// (later parts have consecutive ids) and stores the number of parts, -1 if
+// total stock is insufficient, 0 on invalid input or no memory.
+int allocate_order(Inventory *inv, const char *dest, int qty, int *parts) {
+    *parts = 0;
+    if (qty <= 0) return 0;
+    if (viable_stock(inv) < qty) return -1; // O(log n) from the subtree aggregates
+
+    int first_id = 0;
+    int remaining = qty;
+    for (AVLNode *n = first_viable_lot(inv); n && remaining > 0; n = next_lot(inv, n)) {
+        if (n->stock == 0) continue; // depleted lot
+        int take = n->stock < remaining ? n->stock : remaining;
+        int id = enqueue_order(n, dest, take);
+        if (id <= 0) {
+            // out of memory: roll back the parts already queued, ids included
+            for (int i = 0; i < *parts; i++) {
+                OrderRef *r = order_index_find(first_id + i);
+                remove_order(r->chunk, r->slot);
+            }
+            if (first_id) order_index.next_id = first_id - 1;
+            *parts = 0;
+            return 0;
+        }
+        if (!first_id) first_id = id;
+        (*parts)++;
+        remaining -= take;
+    }
+    journal_scope(inv->product_id);
+    journal_order(dest, qty);
+    return first_id;
+}
+
+// Bulk expiry: detach every lot with date < limit in O(log n) by splitting
+// the tree, then release the expired part (queues included) in one pass.
+// Returns what was dropped: lots, remaining stock and pending orders.
+RangeTotals inventory_expire_before(Inventory *inv, int limit) {
+    RangeTotals t = {0, 0, 0};
+    AVLNode *expired, *kept;
+    split_avl(inv->root, limit, &expired, &kept);
+    inv->root = kept;
+    if (!expired) return t;
+    journal_scope(inv->product_id);
+    journal_int("EXPIRE", limit);
+    t.stock = expired->total_stock;
+    t.orders = expired->total_orders;
+    t.lots = expired->total_lots;
+
+    // the expired lots are a prefix of the lot list: cut it off in O(1)
+    AVLNode *last = expired;
+    while (last->right) last = last->right;
+    AVLNode *first_kept = last->next_lot;
+    inv->lots.next_lot = first_kept;
+    first_kept->prev_lot = &inv->lots;
+#ifdef LOT_INDEX_BTREE
+    btree_delete_below(&inv->index, limit);
+#endif
+
+    free_tree(expired);
+    inv->lot_count -= t.lots;
+    return t;
+}
+
+// Report: in-order from smallest date (closest to expire)
+void report_inorder(FILE *fp, Inventory *inv) {
+    LotScan sc;
+    for (AVLNode *n = scan_first(inv, &sc); n; n = scan_next(inv, &sc)) {
+        int y = n->date / 10000;
+        int m = (n->date / 100) % 100;
+        int d = n->date % 100;
+        fprintf(fp, "Fecha: %04d-%02d-%02d | Producto: %s | Stock: %d | Pedidos en espera: %d\n",
+                y, m, d, intern_name(n->product_id), lot_stock(n), n->order_count);
+    }
+}
+
+void inventory_free(Inventory *inv) {
+    free_tree(inv->root);
+#ifdef LOT_INDEX_BTREE
+    btree_free(&inv->index);
+#endif
+    int product_id = inv->product_id;
+    inventory_init(inv);
+    inv->product_id = product_id;
+}
+
+// Queue an order on the lot with the given date and journal it; returns the
+// order id, -1 if the lot lacks stock, -2 if it has expired, 0 if there is
+// no such lot or no memory
+int inventory_enqueue(Inventory *inv, int date, const char *dest, int qty) {
+    AVLNode *node = inventory_find(inv, date);
+    if (node && date < expiry.today) return -2;
+    int id = enqueue_order(node, dest, qty);
+    if (id > 0) {
+        journal_scope(inv->product_id);
+        journal_enqueue(date, dest, qty);
+    }
+    return id;
+}
+
+#ifdef CONCURRENT_INTAKE
+// ---------------------------------------------------------------------------
+// Recepción concurrente (-DCONCURRENT_INTAKE): varios hilos encolan pedidos a
+// la vez. Inventarios, catálogo, índice de pedidos, pools, tabla de cadenas y
+// contador de ids son compartidos, así que todo el almacén usa un único lock
+// de lectura/escritura (store_lock). intake_order solo toma el lock de
+// lectura: descuenta el stock del lote con CAS, toma el id con un incremento
+// atómico y apila el pedido en la bandeja (inbox) del lote, una pila MPSC sin
+// locks; no escribe nada más compartido. Todo lo demás (altas, bajas,
+// cancelaciones, despacho, comandos batch) va bajo el lock de escritura, que
+// al tomarse vacía todas las bandejas en las colas FIFO en orden global de
+// id. Reportes y búsquedas pueden correr en paralelo con la recepción tomando
+// el lock de lectura. Solo hay paralelismo entre recepción y lectores.
+// ---------------------------------------------------------------------------
+
+AVLNode *intake_dirty; // lots of any inventory with undrained orders in their inbox
+
+// Sort orders by id without allocating (merge sort on the list), so a drain
+// always manages to journal them in id order
+Order *sort_orders(Order *list) {
+    if (!list || !list->next) return list;
+    Order *slow = list, *fast = list->next;
+    while (fast && fast->next) {
+        slow = slow->next;
+        fast = fast->next->next;
+    }
+    Order *b = sort_orders(slow->next);
+    slow->next = NULL;
+    Order *a = sort_orders(list);
+    Order head, *tail = &head;
+    while (a && b) {
+        if (a->id < b->id) { tail->next = a; a = a->next; }
+        else { tail->next = b; b = b->next; }
+        tail = tail->next;
+    }
+    tail->next = a ? a : b;
+    return head.next;
+}
+
+// Move every inbox into its lot's FIFO, refresh the aggregates and journal
+// each order. Ids were handed out in arrival order across all products and
+// the replay gives ids in ENQUEUE line order, so the whole drain is sorted by
+// id, not product by product: otherwise a replayed CANCELID would hit another
+// order. Drained orders go back to order_pool for intake_order to reuse.
+// Caller holds the write lock.
+void intake_drain(void) {
+    AVLNode *lot = __atomic_exchange_n(&intake_dirty, NULL, __ATOMIC_ACQUIRE);
+    Order *pending = NULL;
+    while (lot) {
+        AVLNode *next = lot->dirty_next;
+        Order *o = __atomic_exchange_n(&lot->inbox, NULL, __ATOMIC_ACQUIRE);
+        while (o) {
+            Order *t = o->next;
+            o->next = pending;
+            pending = o;
+            o = t;
+        }
+        lot = next;
+    }
+    pending = sort_orders(pending);
+    while (pending) {
+        Order *o = pending;
+        pending = o->next;
+        AVLNode *node = o->lot;
+        int slot;
+        OrderChunk *c = queue_push(node, o->id, o->dest_id, o->quantity, o->created_ns, &slot);
+        if (c) {
+            order_index_add(o->id, c, slot); // on failure the order is still served, only CANCELID misses it
+            journal_scope(o->scope);
+            journal_enqueue(node->date, intern_name(o->dest_id), o->quantity);
+        } else {
+            node->stock += o->quantity; // no memory for the queue: the order is dropped
+        }
+        refresh_path(node);
+        pool_free(&order_pool, o);
+    }
+}
+
+void inventory_read_begin(Inventory *inv) { (void)inv; pthread_rwlock_rdlock(&store_lock); }
+void inventory_read_end(Inventory *inv) { (void)inv; pthread_rwlock_unlock(&store_lock); }
+
+// Exclusive access to the store, with every inbox drained first
+void inventory_write_begin(Inventory *inv) {
+    (void)inv;
+    pthread_rwlock_wrlock(&store_lock);
+    intake_drain();
+}
+
+void inventory_write_end(Inventory *inv) { (void)inv; pthread_rwlock_unlock(&store_lock); }
+
+// Body of intake_order for an interned destination; caller holds the read lock
+int intake_locked(Inventory *inv, int date, int dest_id, int qty) {
+    int id = 0;
+    AVLNode *node = date < expiry.today ? NULL : inventory_find(inv, date);
+    if (node) {
+        int stock = __atomic_load_n(&node->stock, __ATOMIC_RELAXED);
+        do {
+            if (stock < qty) { id = -1; break; }
+        } while (!__atomic_compare_exchange_n(&node->stock, &stock, stock - qty, 1,
+                                              __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    }
+    Order *o = NULL;
+    if (node && id == 0) {
+        // take back every drained order before carving new slab space; the
+        // drain only frees under the write lock, so the exchange races only
+        // with other intakes, and one of them gets the whole list
+        if (!intake_pool.free_list)
+            intake_pool.free_list = __atomic_exchange_n(&order_pool.free_list, NULL, __ATOMIC_ACQUIRE);
+        o = pool_alloc(&intake_pool);
+    }
+    if (o) {
+        o->dest_id = dest_id;
+        o->quantity = qty;
+        o->lot = node;
+        o->scope = inv->product_id;
+        o->created_ns = stats_now_ns();
+        o->id = id = __atomic_add_fetch(&order_index.next_id, 1, __ATOMIC_RELAXED);
+        Order *top = __atomic_load_n(&node->inbox, __ATOMIC_RELAXED);
+        do {
+            o->next = top;
+        } while (!__atomic_compare_exchange_n(&node->inbox, &top, o, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+        if (!top) {
+            // the inbox was empty: this thread registers the lot for draining
+            AVLNode *d = __atomic_load_n(&intake_dirty, __ATOMIC_RELAXED);
+            do {
+                node->dirty_next = d;
+            } while (!__atomic_compare_exchange_n(&intake_dirty, &d, node, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+        }
+    } else if (node && id == 0) {
+        __atomic_fetch_add(&node->stock, qty, __ATOMIC_RELAXED); // no memory: give the stock back
+    }
+    return id;
+}
+
+// Thread-safe order intake on the lot with the given date. Returns the order
+// id, -1 if the lot lacks stock, -2 if dest is not interned, 0 if there is
+// no such lot (or it expired) or no memory. The order shows up in the lot's
+// queue and aggregates at the next drain. Interning writes the shared string
+// table, which needs the write lock: catalog_intake_order does that first.
+int intake_order(Inventory *inv, int date, const char *dest, int qty) {
+    if (qty <= 0) return 0;
+    inventory_read_begin(inv);
+    int dest_id = intern_find(dest);
+    int id = dest_id < 0 ? -2 : intake_locked(inv, date, dest_id, qty);
+    inventory_read_end(inv);
+    return id;
+}
+
+// Hand the calling thread's order slabs to the shared pool before it exits
+void intake_thread_exit(Inventory *inv) {
+    inventory_write_begin(inv);
+    pool_adopt(&order_pool, &intake_pool);
+    inventory_write_end(inv);
+}
+#endif // CONCURRENT_INTAKE
+
+// ---------------------------------------------------------------------------
+// Catálogo: un inventario (AVL por fecha) por producto. El id internado del
+// producto elige su inventario, así dos productos pueden tener lotes con la
+// misma fecha y cada árbol solo crece con los lotes de su producto. Las
+// vistas de todos los productos (reporte, FEFO) mezclan los inventarios por
+// fecha con un k-way merge sobre un heap de cursores.
+// ---------------------------------------------------------------------------
+
+typedef struct Catalog {
+    Inventory **shards; // product id -> its inventory, NULL until it gets a lot
+    int cap;
+} Catalog;
+
+void catalog_init(Catalog *cat) {
+    memset(cat, 0, sizeof(*cat));
+#ifdef CONCURRENT_INTAKE
+    pthread_once(&store_lock_once, store_lock_init);
+#endif
+}
+
+void catalog_free(Catalog *cat) {
+    for (int i = 0; i < cat->cap; i++) {
+        if (!cat->shards[i]) continue;
+        inventory_free(cat->shards[i]);
+        free(cat->shards[i]);
+    }
+    free(cat->shards);
+    catalog_init(cat);
+}
+
+// Inventory of a product, or NULL if it never had lots
+Inventory *catalog_get(Catalog *cat, int product_id) {
+    return product_id >= 0 && product_id < cat->cap ? cat->shards[product_id] : NULL;
+}
+
+// Inventory of a product, created on first use; NULL if out of memory
+Inventory *catalog_shard(Catalog *cat, int product_id) {
+    if (product_id < 0) return NULL;
+    if (product_id >= cat->cap) {
+        int cap = cat->cap ? cat->cap : 8;
+        while (cap <= product_id) cap *= 2;
+        Inventory **shards = realloc(cat->shards, sizeof(Inventory *) * (size_t)cap);
+        if (!shards) return NULL;
+        memset(shards + cat->cap, 0, sizeof(Inventory *) * (size_t)(cap - cat->cap));
+        cat->shards = shards;
+        cat->cap = cap;
+    }
+    if (!cat->shards[product_id]) {
+        Inventory *inv = malloc(sizeof(Inventory));
+        if (!inv) return NULL;
+        inventory_init(inv);
+        inv->product_id = product_id;
+        cat->shards[product_id] = inv;
+    }
+    return cat->shards[product_id];
+}
+
+int catalog_lot_count(Catalog *cat) {
+    int lots = 0;
+    for (int i = 0; i < cat->cap; i++)
+        if (cat->shards[i]) lots += cat->shards[i]->lot_count;
+    return lots;
+}
+
+// Receive a lot into its product's inventory; 0 if that product already
+// has a lot with this date (or out of memory)
+int catalog_receive(Catalog *cat, int date, const char *product, int stock) {
+    Inventory *inv = catalog_shard(cat, intern(product));
+    return inv ? inventory_receive(inv, date, product, stock) : 0;
+}
+
+// k-way merge of every product's lots by (date, product): a binary heap with
+// one cursor per non-empty inventory, O(log p) per lot for p products
+typedef struct MergeCursor {
+    AVLNode *lot;
+    Inventory *inv;
+    LotScan sc;
+} MergeCursor;
+
+typedef struct CatalogScan {
+    MergeCursor *heap;
+    int size;
+} CatalogScan;
+
+int cursor_before(const MergeCursor *a, const MergeCursor *b) {
+    if (a->lot->date != b->lot->date) return a->lot->date < b->lot->date;
+    return a->inv->product_id < b->inv->product_id;
+}
+
+void merge_sift_down(CatalogScan *cs, int i) {
+    for (;;) {
+        int l = 2 * i + 1, r = l + 1, m = i;
+        if (l < cs->size && cursor_before(&cs->heap[l], &cs->heap[m])) m = l;
+        if (r < cs->size && cursor_before(&cs->heap[r], &cs->heap[m])) m = r;
+        if (m == i) return;
+        MergeCursor t = cs->heap[i]; cs->heap[i] = cs->heap[m]; cs->heap[m] = t;
+        i = m;
+    }
+}
+
+// First lot dated on or after date in the merged scan, NULL if there is none
+// (or no memory); call catalog_scan_end when done
+AVLNode *catalog_scan_from(Catalog *cat, CatalogScan *cs, int date) {
+    cs->size = 0;
+    cs->heap = malloc(sizeof(MergeCursor) * (size_t)(cat->cap ? cat->cap : 1));
+    if (!cs->heap) return NULL;
+    for (int i = 0; i < cat->cap; i++) {
+        Inventory *inv = cat->shards[i];
+        if (!inv) continue;
+        MergeCursor *c = &cs->heap[cs->size];
+        c->inv = inv;
+        c->lot = date == INT_MIN ? scan_first(inv, &c->sc) : scan_from(inv, &c->sc, date);
+        if (c->lot) cs->size++;
+    }
+    for (int i = cs->size / 2 - 1; i >= 0; i--) merge_sift_down(cs, i);
+    return cs->size ? cs->heap[0].lot : NULL;
+}
+
+AVLNode *catalog_scan_first(Catalog *cat, CatalogScan *cs) {
+    return catalog_scan_from(cat, cs, INT_MIN);
+}
+
+AVLNode *catalog_scan_next(CatalogScan *cs) {
+    if (!cs->size) return NULL;
+    MergeCursor *top = &cs->heap[0];
+    top->lot = scan_next(top->inv, &top->sc);
+    if (!top->lot) cs->heap[0] = cs->heap[--cs->size];
+    merge_sift_down(cs, 0);
+    return cs->size ? cs->heap[0].lot : NULL;
+}
+
+void catalog_scan_end(CatalogScan *cs) {
+    free(cs->heap);
+    cs->heap = NULL;
+    cs->size = 0;
+}
+
+// Earliest lot that has not expired over all products, O(p)
+AVLNode *catalog_earliest(Catalog *cat) {
+    AVLNode *best = NULL;
+    for (int i = 0; i < cat->cap; i++) {
+        AVLNode *n = cat->shards[i] ? first_viable_lot(cat->shards[i]) : NULL;
+        if (n && (!best || n->date < best->date)) best = n;
+    }
+    return best;
+}
+
+// FEFO over all products: like allocate_order, walking the merged lots
+int catalog_allocate(Catalog *cat, const char *dest, int qty, int *parts) {
+    *parts = 0;
+    if (qty <= 0) return 0;
+    long long available = 0;
+    for (int i = 0; i < cat->cap; i++)
+        if (cat->shards[i]) available += viable_stock(cat->shards[i]);
+    if (available < qty) return -1;
+
+    CatalogScan cs;
+    int first_id = 0;
+    int remaining = qty;
+    for (AVLNode *n = catalog_scan_from(cat, &cs, expiry.today); n && remaining > 0; n = catalog_scan_next(&cs)) {
+        if (n->stock == 0) continue; // depleted lot
+        int take = n->stock < remaining ? n->stock : remaining;
+        int id = enqueue_order(n, dest, take);
+        if (id <= 0) break;
+        if (!first_id) first_id = id;
+        (*parts)++;
+        remaining -= take;
+    }
+    catalog_scan_end(&cs);
+    if (remaining > 0) {
+        // out of memory: roll back the parts already queued, ids included
+        for (int i = 0; i < *parts; i++) {
+            OrderRef *r = order_index_find(first_id + i);
+            remove_order(r->chunk, r->slot);
+        }
+        if (first_id) order_index.next_id = first_id - 1;
+        *parts = 0;
+        return 0;
+    }
+    journal_scope(-1);
+    journal_order(dest, qty);
+    return first_id;
+}
+
+// Lot with this date in the lowest-id product that has one; *matches gets
+// how many products have a lot on that date
+AVLNode *catalog_find_date(Catalog *cat, int date, int *matches) {
+    AVLNode *first = NULL;
+    *matches = 0;
+    for (int i = 0; i < cat->cap; i++) {
+        AVLNode *n = cat->shards[i] ? inventory_find(cat->shards[i], date) : NULL;
+        if (!n) continue;
+        if (!first) first = n;
+        (*matches)++;
+    }
+    return first;
+}
+
+// Drop the lot with this date from every product; returns how many
+int catalog_drop(Catalog *cat, int date) {
+    int dropped = 0;
+    for (int i = 0; i < cat->cap; i++)
+        if (cat->shards[i]) dropped += inventory_drop(cat->shards[i], date);
+    return dropped;
+}
+
+// Cancel the first order matching dest/qty in any lot with this date
+int catalog_cancel(Catalog *cat, int date, const char *dest, int qty, int *found_lot) {
+    *found_lot = 0;
+    for (int i = 0; i < cat->cap; i++) {
+        AVLNode *n = cat->shards[i] ? inventory_find(cat->shards[i], date) : NULL;
+        if (!n) continue;
+        *found_lot = 1;
+        if (cancel_order_in_node(n, dest, qty)) return 1;
+    }
+    return 0;
+}
+
+RangeTotals catalog_totals_between(Catalog *cat, int from, int to) {
+    RangeTotals sum = {0, 0, 0};
+    for (int i = 0; i < cat->cap; i++) {
+        if (!cat->shards[i]) continue;
+        RangeTotals t = totals_between(cat->shards[i]->root, from, to);
+        sum.stock += t.stock;
+        sum.orders += t.orders;
+        sum.lots += t.lots;
+    }
+    return sum;
+}
+
+RangeTotals catalog_expire_before(Catalog *cat, int limit) {
+    RangeTotals sum = {0, 0, 0};
+    for (int i = 0; i < cat->cap; i++) {
+        if (!cat->shards[i]) continue;
+        RangeTotals t = inventory_expire_before(cat->shards[i], limit);
+        sum.stock += t.stock;
+        sum.orders += t.orders;
+        sum.lots += t.lots;
+    }
+    return sum;
+}
+
+// Report every product merged by date
+void catalog_report(FILE *fp, Catalog *cat) {
+    CatalogScan cs;
+    for (AVLNode *n = catalog_scan_first(cat, &cs); n; n = catalog_scan_next(&cs)) {
+        int y = n->date / 10000;
+        int m = (n->date / 100) % 100;
+        int d = n->date % 100;
+        fprintf(fp, "Fecha: %04d-%02d-%02d | Producto: %s | Stock: %d | Pedidos en espera: %d\n",
+                y, m, d, intern_name(n->product_id), lot_stock(n), n->order_count);
+    }
+    catalog_scan_end(&cs);
+}
+
+#ifdef CONCURRENT_INTAKE
+// Exclusive access to the whole catalog (the store lock), inboxes drained
+void catalog_write_begin(Catalog *cat) {
+    (void)cat;
+    pthread_rwlock_wrlock(&store_lock);
+    intake_drain();
+}
+
+void catalog_write_end(Catalog *cat) { (void)cat; pthread_rwlock_unlock(&store_lock); }
+
+// Thread-safe intake into one product's lot (see intake_order). New
+// destinations are interned here under the write lock, between two read
+// sections, because the string table is shared by every product.
+int catalog_intake_order(Catalog *cat, const char *product, int date, const char *dest, int qty) {
+    if (qty <= 0) return 0;
+    pthread_rwlock_rdlock(&store_lock);
+    int dest_id = intern_find(dest);
+    if (dest_id < 0) {
+        pthread_rwlock_unlock(&store_lock);
+        catalog_write_begin(cat);
+        dest_id = intern(dest);
+        catalog_write_end(cat);
+        if (dest_id < 0) return 0;
+        pthread_rwlock_rdlock(&store_lock);
+    }
+    Inventory *inv = catalog_get(cat, intern_find(product));
+    int id = inv ? intake_locked(inv, date, dest_id, qty) : 0;
+    pthread_rwlock_unlock(&store_lock);
+    return id;
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// Despacho: consume las colas de pedidos. Los pedidos salen de los lotes más
+// próximos a vencer (FIFO dentro de cada lote), se agrupan por destino en
+// envíos y se registra su finalización con la latencia desde que se encolaron.
+// Sacar los pedidos de las colas (dispatch_take) ocurre siempre en el hilo
+// que despacha, bajo el lock exclusivo, porque modifica los lotes y el índice
+// de pedidos. Con -DCONCURRENT_INTAKE solo el armado de envíos (agrupar por
+// destino y registrar la finalización) pasa a un pool de hilos alimentado por
+// anillos acotados, uno por hilo: si un anillo está lleno quien despacha
+// espera (contrapresión) y cada espera queda contada en STATS. Sin esa
+// bandera no hay hilos y los envíos se arman en el mismo hilo.
+// ---------------------------------------------------------------------------
+
+#define DISPATCH_BATCH 64 // orders taken from the queues (and shipped) at once
+
+typedef struct DispatchItem {
+    int order_id;
+    int dest_id;
+    int product_id;
+    int date;
+    int quantity;
+    long long created_ns; // enqueue time of the order
+} DispatchItem;
+
+typedef struct DispatchStats {
+    long long orders;
+    long long units;
+    long long shipments;  // one per destination in each shipped batch
+    long long stalls;     // pushes that found the worker's ring full
+    long long started_ns; // first dispatch, for the throughput
+    LatencyHist latency;  // enqueue -> shipment completed
+} DispatchStats;
+
+DispatchStats dispatch_stats;
+
+// First lot dated on or after from that has pending orders; subtrees with no
+// orders (total_orders == 0) are skipped, so drained lots cost nothing
+AVLNode *first_pending_lot(AVLNode *root, int from) {
+    if (!root || !root->total_orders) return NULL;
+    if (root->date >= from) {
+        AVLNode *l = first_pending_lot(root->left, from);
+        if (l) return l;
+        if (root->order_count) return root;
+    }
+    return first_pending_lot(root->right, from);
+}
+
+// Move up to max orders from the head of the lot's queue into out. The stock
+// they reserved stays consumed: they leave the queue as shipped.
+int take_from_lot(AVLNode *lot, int max, DispatchItem *out) {
+    int n = 0;
+    while (lot->head && n < max) {
+        OrderChunk *c = lot->head;
+        int i = c->begin; // never a hole: holes are trimmed off both ends
+        DispatchItem *it = &out[n++];
+        it->order_id = c->id[i];
+        it->dest_id = c->dest_id[i];
+        it->product_id = lot->product_id;
+        it->date = lot->date;
+        it->quantity = c->quantity[i];
+        it->created_ns = c->created_ns[i];
+        order_index_remove(c->id[i]);
+        queue_remove(c, i);
+    }
+    if (n) refresh_path(lot);
+    return n;
+}
+
+// Take up to max pending orders, earliest-expiry lot first, from one product
+// or from every product in (date, product) order. Expired lots are skipped:
+// the expiry sweep moves their orders to a lot that can still ship.
+int dispatch_take(Catalog *cat, Inventory *scope, int max, DispatchItem *out) {
+    int n = 0;
+    if (scope) {
+        for (AVLNode *lot = first_pending_lot(scope->root, expiry.today); lot && n < max;
+             lot = first_pending_lot(scope->root, lot->date))
+            n += take_from_lot(lot, max - n, out + n);
+        return n;
+    }
+    int from = expiry.today;
+    while (n < max) {
+        AVLNode *best = NULL;
+        for (int i = 0; i < cat->cap; i++) { // shards in product order: ties keep the lower id
+            AVLNode *lot = cat->shards[i] ? first_pending_lot(cat->shards[i]->root, from) : NULL;
+            if (lot && (!best || lot->date < best->date)) best = lot;
+        }
+        if (!best) break;
+        n += take_from_lot(best, max - n, out + n);
+        from = best->date;
+    }
+    return n;
+}
+
+int cmp_dispatch_item(const void *a, const void *b) {
+    const DispatchItem *x = a, *y = b;
+    if (x->dest_id != y->dest_id) return x->dest_id < y->dest_id ? -1 : 1;
+    return (x->order_id > y->order_id) - (x->order_id < y->order_id);
+}
+
+// Group a batch by destination (one shipment each, orders kept in id order)
+// and record it as completed
+void ship_batch(DispatchItem *items, int n, DispatchStats *st) {
+    qsort(items, (size_t)n, sizeof(DispatchItem), cmp_dispatch_item);
+    long long now = stats_now_ns();
+    for (int i = 0; i < n; i++) {
+        if (i == 0 || items[i].dest_id != items[i - 1].dest_id) st->shipments++;
+        st->orders++;
+        st->units += items[i].quantity;
+        latency_add(&st->latency, now - items[i].created_ns);
+    }
+}
+
+#ifdef CONCURRENT_INTAKE
+#define DISPATCH_RING 1024 // slots per worker ring (power of two)
+
+// Single-producer single-consumer ring: the dispatcher pushes, one worker pops
+typedef struct DispatchRing {
+    size_t head; // next slot to pop, advanced by the worker
+    size_t tail; // next slot to fill, advanced by the dispatcher
+    DispatchItem slot[DISPATCH_RING];
+} DispatchRing;
+
+typedef struct DispatchWorker {
+    pthread_t thread;
+    int stop;
+    DispatchRing ring;
+} DispatchWorker;
+
+typedef struct DispatchPool {
+    DispatchWorker *workers;
+    int count;
+    pthread_mutex_t lock; // guards dispatch_stats, updated by every worker
+} DispatchPool;
+
+DispatchPool dispatch_pool = { .lock = PTHREAD_MUTEX_INITIALIZER };
+int dispatch_workers = 2; // --dispatch-workers N
+
+int ring_push(DispatchRing *r, const DispatchItem *it) {
+    size_t tail = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+    if (tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == DISPATCH_RING) return 0;
+    r->slot[tail & (DISPATCH_RING - 1)] = *it;
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+int ring_pop(DispatchRing *r, DispatchItem *out, int max) {
+    size_t head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    size_t avail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) - head;
+    int n = avail < (size_t)max ? (int)avail : max;
+    for (int i = 0; i < n; i++) out[i] = r->slot[(head + i) & (DISPATCH_RING - 1)];
+    __atomic_store_n(&r->head, head + n, __ATOMIC_RELEASE);
+    return n;
+}
+
+size_t ring_size(DispatchRing *r) {
+    return __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+}
+
+void dispatch_idle(void) {
+    struct timespec ts = {0, 50000};
+    nanosleep(&ts, NULL);
+}
+
+void *dispatch_worker(void *arg) {
+    DispatchWorker *w = arg;
+    DispatchItem batch[DISPATCH_BATCH];
+    for (;;) {
+        // stop is read before the ring, so every item pushed before it is seen
+        int stopping = __atomic_load_n(&w->stop, __ATOMIC_ACQUIRE);
+        int n = ring_pop(&w->ring, batch, DISPATCH_BATCH);
+        if (!n) {
+            if (stopping) break;
+            dispatch_idle();
+            continue;
+        }
+        DispatchStats local;
+        memset(&local, 0, sizeof(local));
+        ship_batch(batch, n, &local);
+        pthread_mutex_lock(&dispatch_pool.lock);
+        dispatch_stats.orders += local.orders;
+        dispatch_stats.units += local.units;
+        dispatch_stats.shipments += local.shipments;
+        latency_merge(&dispatch_stats.latency, &local.latency);
+        pthread_mutex_unlock(&dispatch_pool.lock);
+    }
+    return NULL;
+}
+
+// Start n workers; returns 0 if none could be started
+int dispatch_start(int n) {
+    DispatchWorker *w = calloc((size_t)n, sizeof(DispatchWorker));
+    if (!w) return 0;
+    int started = 0;
+    while (started < n && pthread_create(&w[started].thread, NULL, dispatch_worker, &w[started]) == 0) started++;
+    if (!started) { free(w); return 0; }
+    dispatch_pool.workers = w;
+    dispatch_pool.count = started;
+    return 1;
+}
+
+// Ship what is still in the rings and join the workers
+void dispatch_stop(void) {
+    for (int i = 0; i < dispatch_pool.count; i++)
+        __atomic_store_n(&dispatch_pool.workers[i].stop, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < dispatch_pool.count; i++) pthread_join(dispatch_pool.workers[i].thread, NULL);
+    free(dispatch_pool.workers);
+    dispatch_pool.workers = NULL;
+    dispatch_pool.count = 0;
+}
+
+// Orders waiting in the rings
+long long dispatch_in_flight(void) {
+    long long n = 0;
+    for (int i = 0; i < dispatch_pool.count; i++) n += (long long)ring_size(&dispatch_pool.workers[i].ring);
+    return n;
+}
+
+// Hand a batch already taken off the queues to the workers, which only build
+// and record the shipments. Each destination always goes to the same worker
+// so its shipments keep FIFO order; waits while the target ring is full
+void dispatch_ship(DispatchItem *items, int n) {
+    if (!dispatch_pool.count) dispatch_start(dispatch_workers);
+    pthread_mutex_lock(&dispatch_pool.lock);
+    if (!dispatch_stats.started_ns) dispatch_stats.started_ns = stats_now_ns();
+    if (!dispatch_pool.count) { // no threads: ship on the calling thread
+        ship_batch(items, n, &dispatch_stats);
+        pthread_mutex_unlock(&dispatch_pool.lock);
+        return;
+    }
+    pthread_mutex_unlock(&dispatch_pool.lock);
+    long long stalls = 0;
+    for (int i = 0; i < n; i++) {
+        DispatchRing *r = &dispatch_pool.workers[items[i].dest_id % dispatch_pool.count].ring;
+        if (ring_push(r, &items[i])) continue;
+        stalls++;
+        while (!ring_push(r, &items[i])) dispatch_idle();
+    }
+    if (stalls) {
+        pthread_mutex_lock(&dispatch_pool.lock);
+        dispatch_stats.stalls += stalls;
+        pthread_mutex_unlock(&dispatch_pool.lock);
+    }
+}
+#else
+void dispatch_ship(DispatchItem *items, int n) {
+    if (!dispatch_stats.started_ns) dispatch_stats.started_ns = stats_now_ns();
+    ship_batch(items, n, &dispatch_stats);
+}
+#endif
+
+// Dispatch up to max orders (one product, or all when scope is NULL); returns
+// the orders taken and their units. Journaled as DISPATCH <n>, which replays
+// to the same orders; replayed orders were shipped before the restart, so the
+// replay only takes them off the queues.
+int dispatch_orders(Catalog *cat, Inventory *scope, int max, long long *units) {
+    DispatchItem batch[DISPATCH_BATCH];
+    int total = 0;
+    *units = 0;
+    while (total < max) {
+        int n = dispatch_take(cat, scope, max - total < DISPATCH_BATCH ? max - total : DISPATCH_BATCH, batch);
+        if (!n) break;
+        total += n;
+        for (int i = 0; i < n; i++) *units += batch[i].quantity;
+        if (!journal.suspended) dispatch_ship(batch, n);
+    }
+    if (total) {
+        journal_scope(scope ? scope->product_id : -1);
+        journal_int("DISPATCH", total);
+    }
+    return total;
+}
+
+// ---------------------------------------------------------------------------
+// Vencimiento automático: un reloj (fecha simulada con CLOCK, o la del sistema
+// con --clock real) marca vencidos los lotes con fecha anterior a hoy. Cada
+// producto ya tiene sus lotes ordenados por fecha, así que la agenda de
+// vencimientos es la propia lista de lotes: los vencidos están siempre al
+// principio. Un lote vencido se retira por partes: cada pedido pasa al primer
+// lote vigente del producto con stock suficiente (conserva su id) o queda
+// fallido, y el lote se elimina al vaciarse su cola. Cada comando avanza el
+// barrido a lo sumo EXPIRY_BUDGET pasos, así un vencimiento masivo nunca
+// frena la recepción de pedidos.
+// ---------------------------------------------------------------------------
+
+#define EXPIRY_BUDGET 64
+
+// Today's system date as AAAAMMDD
+int system_date(void) {
+    time_t now = time(NULL);
+    struct tm tm;
+#ifdef _WIN32
+    localtime_s(&tm, &now);
+#else
+    localtime_r(&now, &tm);
+#endif
+    return (tm.tm_year + 1900) * 10000 + (tm.tm_mon + 1) * 100 + tm.tm_mday;
+}
+
+// Move the clock to date; it never goes back. Journaled so a replay expires
+// the same lots. Returns 0 if date is before today.
+int expiry_set_clock(int date) {
+    if (date < expiry.today) return 0;
+    if (date > expiry.today) {
+        expiry.today = date;
+        expiry_rearm();
+        journal_int("CLOCK", date);
+    }
+    return 1;
+}
+
+// Expired lots still waiting for the sweep
+int expired_lots(Catalog *cat) {
+    int lots = 0;
+    for (int i = 0; i < cat->cap; i++)
+        if (cat->shards[i]) lots += totals_before(cat->shards[i]->root, expiry.today).lots;
+    return lots;
+}
+
+// First lot dated from onwards that can take qty more units. max_stock prunes
+// every subtree without room, so this is O(log n) however many lots are full.
+AVLNode *first_lot_with_stock(AVLNode *root, int from, int qty) {
+    if (!root || root->max_stock < qty) return NULL;
+    if (root->date >= from) {
+        AVLNode *l = first_lot_with_stock(root->left, from, qty);
+        if (l) return l;
+        if (root->stock >= qty) return root;
+    }
+    return first_lot_with_stock(root->right, from, qty);
+}
+
+// First lot of the product that has not expired and can take qty more units
+AVLNode *viable_lot_for(Inventory *inv, int qty) {
+    return first_lot_with_stock(inv->root, expiry.today, qty);
+}
+
+// Handle up to max orders of an expired lot, oldest first: each one moves to
+// viable_lot_for (same id, same creation time) or fails and is dropped. The
+// lot is removed once its queue is empty. Journaled as RETIRE so a replay
+// takes exactly the same steps; returns the orders handled.
+int retire_lot(Inventory *inv, AVLNode *lot, int max) {
+    int date = lot->date, n = 0;
+    while (lot->head && n < max) {
+        OrderChunk *c = lot->head;
+        int i = c->begin;
+        int id = c->id[i], dest_id = c->dest_id[i], qty = c->quantity[i];
+        long long created_ns = c->created_ns[i];
+        queue_remove(c, i);
+        AVLNode *to = viable_lot_for(inv, qty);
+        int slot = 0;
+        OrderChunk *moved = to ? queue_push(to, id, dest_id, qty, created_ns, &slot) : NULL;
+        OrderRef *r = order_index_find(id);
+        if (moved) {
+            to->stock -= qty;
+            refresh_path(to);
+            if (r) { r->chunk = moved; r->slot = slot; }
+            expiry.moved++;
+        } else {
+            if (r) order_index_remove(id);
+            expiry.failed++;
+            expiry.failed_units += qty;
+        }
+        n++;
+    }
+    journal_scope(inv->product_id);
+    journal_retire(date, n);
+    if (lot->head) {
+        refresh_path(lot);
+    } else {
+        inventory_remove(inv, date);
+        expiry.retired++;
+    }
+    return n;
+}
+
+// With --clock real, advance to the system date (read at most once a minute)
+void expiry_refresh(void) {
+    if (!expiry.real) return;
+    long long now = (long long)time(NULL);
+    if (expiry.checked_at && now - expiry.checked_at < 60) return;
+    expiry.checked_at = now;
+    expiry_set_clock(system_date());
+}
+
+// One bounded step of the sweep, run after every command: retire expired
+// lots shard by shard for at most EXPIRY_BUDGET units of work (a shard
+// checked, an order handled). Skipped while replaying: the journal's CLOCK
+// and RETIRE lines already carry every step.
+void expiry_tick(Catalog *cat) {
+    if (journal.suspended) return;
+    expiry_refresh();
+    if (!expiry.armed) return;
+    long long t0 = stats_now_ns();
+    int work = 0;
+    while (work < EXPIRY_BUDGET && expiry.shard < cat->cap) {
+        Inventory *inv = cat->shards[expiry.shard];
+        AVLNode *lot = inv ? earliest_lot(inv) : NULL;
+        if (!lot || lot->date >= expiry.today) {
+            expiry.shard++;
+            work++;
+            continue;
+        }
+        work += 1 + retire_lot(inv, lot, EXPIRY_BUDGET - work);
+    }
+    if (expiry.shard >= cat->cap) expiry.armed = 0;
+    latency_add(&expiry.latency, stats_now_ns() - t0);
+}
+
+// Helper to read string with spaces
+void read_line(char *buf, int size) {
+    if (!fgets(buf, size, stdin)) { buf[0] = '\0'; return; }
+    size_t len = strlen(buf);
+    if (len && buf[len-1] == '\n') buf[len-1] = '\0';
+}
+
+void pause() { printf("Presiona ENTER para continuar...\n"); getchar(); }
+
+// Ask for a product: returns its inventory, or NULL for all products (empty
+// answer); *unknown is set when the named product has no inventory
+Inventory *ask_product(Catalog *cat, char *buf, int size, int *unknown) {
+    printf("Ingrese producto (ENTER = todos los productos): ");
+    read_line(buf, size);
+    *unknown = 0;
+    if (!buf[0]) return NULL;
+    Inventory *inv = catalog_get(cat, intern_find(buf));
+    if (!inv) *unknown = 1;
+    return inv;
+}
+
+// ---------------------------------------------------------------------------
+// Modo batch: flujo de comandos no interactivo
+//   PRODUCT [producto...]  (limita los comandos siguientes a un producto;
+//                           sin nombre vuelve a todos los productos)
+//   RECV <fecha> <cantidad> <producto...>
+//   ORDER <destino...> <cantidad>
+//   ENQUEUE <fecha> <destino...> <cantidad>   (pedido en la cola de un lote dado)
+//   DROP <fecha>
+//   CANCEL <fecha> <destino...> <cantidad>
+//   CANCELID <id>
+//   QUERY <desde> <hasta>   (totales de lotes/stock/pedidos en el rango)
+//   BEFORE <fecha>          (totales de lotes que vencen antes de la fecha)
+//   EXPIRE <fecha>          (elimina todos los lotes con fecha anterior)
+//   LOAD <archivo>          (carga masiva de un manifiesto fecha,producto,stock)
+//   SNAPSHOT [archivo]      (guarda el estado completo y reinicia el journal)
+//   REPORT
+//   EXPORT <csv|json> <archivo|-> [desde hasta [por_pagina [pagina]]]
+//                           (reporte por rango y por páginas; "-" escribe
+//                            en la salida del batch)
+//   FEFO                    (lote más próximo a vencer)
+//   DISPATCH [cantidad]     (despacha pedidos de los lotes más próximos a
+//                            vencer, agrupados por destino; sin cantidad, todos)
+//   STATS                   (contadores del árbol, memoria y latencias)
+// Lineas vacias y las que empiezan con '#' se ignoran.
+// ---------------------------------------------------------------------------
+
+#define OUTBUF_SIZE (1 << 16)
+
+// Buffered writer: accumulates output and flushes in large blocks
+typedef struct OutBuf {
+    FILE *fp;
+    size_t len;
+    char data[OUTBUF_SIZE];
+} OutBuf;
+
+// A NULL fp discards the output (used when replaying the journal)
+void out_flush(OutBuf *o) {
+    if (o->len && o->fp) fwrite(o->data, 1, o->len, o->fp);
+    o->len = 0;
+}
+
+void out_write(OutBuf *o, const char *s, size_t n) {
+    if (n >= OUTBUF_SIZE) { out_flush(o); if (o->fp) fwrite(s, 1, n, o->fp); return; }
+    if (o->len + n > OUTBUF_SIZE) out_flush(o);
+    memcpy(o->data + o->len, s, n);
+    o->len += n;
+}
+
+void out_str(OutBuf *o, const char *s) { out_write(o, s, strlen(s)); }
+
+void out_char(OutBuf *o, char c) {
+    if (o->len == OUTBUF_SIZE) out_flush(o);
+    o->data[o->len++] = c;
+}
+
+void out_int(OutBuf *o, long long v) {
+    char tmp[24];
+    int i = sizeof(tmp);
+    unsigned long long u = v < 0 ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+    do { tmp[--i] = (char)('0' + u % 10); u /= 10; } while (u);
+    if (v < 0) tmp[--i] = '-';
+    out_write(o, tmp + i, sizeof(tmp) - i);
+}
+
+// Read a whole stream into one NUL-terminated buffer
+char *read_all(FILE *fp, size_t *out_len) {
+    size_t cap = 1 << 20, len = 0;
+    char *buf = malloc(cap + 1);
+    if (!buf) return NULL;
+    size_t n;
+    while ((n = fread(buf + len, 1, cap - len, fp)) > 0) {
+        len += n;
+        if (len == cap) {
+            char *nb = realloc(buf, cap * 2 + 1);
+            if (!nb) { free(buf); return NULL; }
+            buf = nb;
+            cap *= 2;
+        }
+    }
+    buf[len] = '\0';
+    *out_len = len;
+    return buf;
+}
+
+// Token helpers over a [p, end) line slice
+const char *skip_spaces(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    return p;
+}
+
+const char *token_end(const char *p, const char *end) {
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r') p++;
+    return p;
+}
+
+// Parse a decimal integer token; returns 1 on success
+int parse_int(const char *p, const char *end, int *out) {
+    int neg = 0;
+    long long v = 0;
+    if (p < end && (*p == '-' || *p == '+')) { neg = (*p == '-'); p++; }
+    if (p == end) return 0;
+    for (; p < end; p++) {
+        if (*p < '0' || *p > '9') return 0;
+        v = v * 10 + (*p - '0');
+        if (v > 2147483647LL) return 0;
+    }
+    *out = (int)(neg ? -v : v);
+    return 1;
+}
+
+// Split "<texto...> <entero>" taking the last token as the integer
+int split_text_int(const char *p, const char *end, char *text, size_t size, int *value) {
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) end--;
+    const char *last = end;
+    while (last > p && last[-1] != ' ' && last[-1] != '\t') last--;
+    if (!parse_int(last, end, value)) return 0;
+    const char *tend = last;
+    while (tend > p && (tend[-1] == ' ' || tend[-1] == '\t')) tend--;
+    size_t n = (size_t)(tend - p);
+    if (n == 0 || n >= size) return 0;
+    memcpy(text, p, n);
+    text[n] = '\0';
+    return 1;
+}
+
+// ---------------------------------------------------------------------------
+// Carga masiva desde manifiesto: filas "fecha,producto,stock" (separador
+// ',', ';' o tabulador; se admite una fila de encabezado). Las filas se
+// ordenan por fecha con radix sort y se agrupan por producto; cada grupo se
+// mezcla con los lotes ya cargados de ese producto y su AVL se reconstruye
+// balanceado en O(n), sin una inserción por lote.
+// ---------------------------------------------------------------------------
+
+typedef struct ManifestRow {
+    int date;
+    int product_id;
+    int stock;
+    long line;
+} ManifestRow;
+
+typedef struct ManifestResult {
+    long loaded;
+    long duplicates;
+    long invalid;
+} ManifestResult;
+
+// Called for each rejected row: why is "duplicado", "invalido" or "memoria"
+typedef void (*RejectFn)(long line, int date, const char *why, void *ctx);
+
+// Stable LSD radix sort by date, 8 bits per pass
+int sort_rows_by_date(ManifestRow *rows, long n) {
+    ManifestRow *tmp = malloc(sizeof(ManifestRow) * (size_t)(n ? n : 1));
+    if (!tmp) return 0;
+    ManifestRow *src = rows, *dst = tmp;
+    for (int shift = 0; shift < 32; shift += 8) {
+        long count[257] = {0};
+        for (long i = 0; i < n; i++)
+            count[((((unsigned)src[i].date) ^ 0x80000000u) >> shift & 0xFF) + 1]++;
+        for (int b = 0; b < 256; b++) count[b + 1] += count[b];
+        for (long i = 0; i < n; i++)
+            dst[count[(((unsigned)src[i].date) ^ 0x80000000u) >> shift & 0xFF]++] = src[i];
+        ManifestRow *t = src; src = dst; dst = t;
+    }
+    // four passes: the sorted data is back in rows
+    free(tmp);
+    return 1;
+}
+
+// Stable counting sort by product id, so each product's rows stay in date order
+int sort_rows_by_product(ManifestRow *rows, long n, int products) {
+    ManifestRow *tmp = malloc(sizeof(ManifestRow) * (size_t)(n ? n : 1));
+    long *count = calloc((size_t)products + 1, sizeof(long));
+    if (!tmp || !count) { free(tmp); free(count); return 0; }
+    for (long i = 0; i < n; i++) count[rows[i].product_id + 1]++;
+    for (int b = 0; b < products; b++) count[b + 1] += count[b];
+    for (long i = 0; i < n; i++) tmp[count[rows[i].product_id]++] = rows[i];
+    memcpy(rows, tmp, sizeof(ManifestRow) * (size_t)n);
+    free(count);
+    free(tmp);
+    return 1;
+}
+
+// Build a perfectly balanced subtree from nodes[lo..hi] (sorted by date)
+AVLNode *build_balanced(AVLNode **nodes, long lo, long hi) {
+    if (lo > hi) return NULL;
+    long mid = lo + (hi - lo) / 2;
+    AVLNode *n = nodes[mid];
+    n->left = build_balanced(nodes, lo, mid - 1);
+    n->right = build_balanced(nodes, mid + 1, hi);
+    update_node(n);
+    return n;
+}
+
+// Rebuild inv from nodes[0..n) in date order: balanced tree plus lot list
+void inventory_rebuild(Inventory *inv, AVLNode **nodes, long n) {
+    AVLNode *prev = &inv->lots;
+    for (long i = 0; i < n; i++) {
+        nodes[i]->prev_lot = prev;
+        prev->next_lot = nodes[i];
+        prev = nodes[i];
+    }
+    prev->next_lot = &inv->lots;
+    inv->lots.prev_lot = prev;
+    inv->root = build_balanced(nodes, 0, n - 1);
+    if (inv->root) inv->root->parent = NULL;
+    inv->lot_count = (int)n;
+#ifdef LOT_INDEX_BTREE
+    // same as a failed btree_insert: an index missing lots would lose them
+    if (!btree_build(&inv->index, nodes, n)) {
+        perror("btree_build");
+        exit(EXIT_FAILURE);
+    }
+#endif
+    if (n && nodes[0]->date < expiry.today) expiry_rearm();
+}
+
+// Parse one manifest line; returns 1 and fills row, 0 if malformed
+int parse_manifest_line(const char *p, const char *end, ManifestRow *row) {
+    char sep = 0;
+    for (const char *q = p; q < end && !sep; q++)
+        if (*q == ',' || *q == ';' || *q == '\t') sep = *q;
+    if (!sep) return 0;
+    const char *f1 = memchr(p, sep, (size_t)(end - p));
+    const char *f3 = end;
+    while (f3 > f1 && f3[-1] != sep) f3--;
+    if (f3 - 1 == f1) return 0; // only two fields
+    const char *d0 = skip_spaces(p, f1), *d1 = f1;
+    while (d1 > d0 && (d1[-1] == ' ' || d1[-1] == '\t')) d1--;
+    const char *s0 = skip_spaces(f3, end), *s1 = end;
+    while (s1 > s0 && (s1[-1] == ' ' || s1[-1] == '\t' || s1[-1] == '\r')) s1--;
+    const char *p0 = skip_spaces(f1 + 1, f3 - 1), *p1 = f3 - 1;
+    while (p1 > p0 && (p1[-1] == ' ' || p1[-1] == '\t')) p1--;
+    char name[MAX_NAME * 4];
+    size_t plen = (size_t)(p1 - p0);
+    if (!parse_int(d0, d1, &row->date) || !parse_int(s0, s1, &row->stock) || row->stock < 0) return 0;
+    if (plen == 0 || plen >= sizeof(name)) return 0;
+    memcpy(name, p0, plen);
+    name[plen] = '\0';
+    row->product_id = intern(name);
+    return row->product_id >= 0;
+}
+
+// Merge rows[0..n) (one product, sorted by date) with the lots already in
+// inv. Duplicate dates (against the tree or earlier rows) are rejected like
+// in insert_avl: the lot already present wins. Returns 0 if out of memory.
+int merge_rows(Inventory *inv, const ManifestRow *rows, long n, ManifestResult *res,
+               RejectFn on_reject, void *ctx) {
+    long total = inv->lot_count + n;
+    AVLNode **nodes = malloc(sizeof(AVLNode *) * (size_t)(total ? total : 1));
+    if (!nodes) return 0;
+    long count = 0, i = 0;
+    AVLNode *cur = earliest_lot(inv);
+    while (cur || i < n) {
+        if (i == n || (cur && cur->date < rows[i].date)) {
+            nodes[count++] = cur;
+            cur = next_lot(inv, cur);
+            continue;
+        }
+        const ManifestRow *row = &rows[i++];
+        int last = count ? nodes[count - 1]->date : 0;
+        if ((cur && cur->date == row->date) || (count && last == row->date)) {
+            res->duplicates++;
+            if (on_reject) on_reject(row->line, row->date, "duplicado", ctx);
+            continue;
+        }
+        AVLNode *node = new_node_id(row->date, row->product_id, row->stock);
+        if (!node) {
+            res->invalid++;
+            if (on_reject) on_reject(row->line, row->date, "memoria", ctx);
+            continue;
+        }
+        nodes[count++] = node;
+        res->loaded++;
+        journal_recv(row->date, row->stock, row->product_id);
+    }
+    inventory_rebuild(inv, nodes, count);
+    free(nodes);
+    return 1;
+}
+
+// Load a manifest buffer into the catalog, each row into its product's
+// inventory. Returns 0 if out of memory.
+int load_manifest(Catalog *cat, const char *buf, size_t len, ManifestResult *res,
+                  RejectFn on_reject, void *ctx) {
+    memset(res, 0, sizeof(*res));
+    long cap = 1024, n = 0, line = 0;
+    ManifestRow *rows = malloc(sizeof(ManifestRow) * (size_t)cap);
+    if (!rows) return 0;
+    const char *p = buf, *end = buf + len;
+    while (p < end) {
+        const char *eol = memchr(p, '\n', (size_t)(end - p));
+        if (!eol) eol = end;
+        line++;
+        const char *s = skip_spaces(p, eol);
+        if (s < eol && *s != '#') {
+            ManifestRow row;
+            if (parse_manifest_line(s, eol, &row)) {
+                if (n == cap) {
+                    ManifestRow *nr = realloc(rows, sizeof(ManifestRow) * (size_t)cap * 2);
+                    if (!nr) { free(rows); return 0; }
+                    rows = nr;
+                    cap *= 2;
+                }
+                row.line = line;
+                rows[n++] = row;
+            } else if (!(line == 1 && (*s < '0' || *s > '9'))) { // header row is fine
+                res->invalid++;
+                if (on_reject) on_reject(line, 0, "invalido", ctx);
+            }
+        }
+        p = eol < end ? eol + 1 : end;
+    }
+    if (!sort_rows_by_date(rows, n) || !sort_rows_by_product(rows, n, strings.count)) {
+        free(rows);
+        return 0;
+    }
+    for (long from = 0, to; from < n; from = to) {
+        for (to = from + 1; to < n && rows[to].product_id == rows[from].product_id; to++) {}
+        Inventory *inv = catalog_shard(cat, rows[from].product_id);
+        if (!inv || !merge_rows(inv, rows + from, to - from, res, on_reject, ctx)) {
+            free(rows);
+            return 0;
+        }
+    }
+    free(rows);
+    return 1;
+}
+
+// Read a manifest file and load it; returns 0 if it cannot be read
+int load_manifest_file(Catalog *cat, const char *path, ManifestResult *res,
+                       RejectFn on_reject, void *ctx) {
+    FILE *in = fopen(path, "rb");
+    if (!in) return 0;
+    size_t len = 0;
+    char *buf = read_all(in, &len);
+    fclose(in);
+    if (!buf) return 0;
+    int ok = load_manifest(cat, buf, len, res, on_reject, ctx);
+    free(buf);
+    return ok;
+}
+
+void print_reject(long line, int date, const char *why, void *ctx) {
+    (void)ctx;
+    if (strcmp(why, "duplicado") == 0)
+        printf("Manifiesto línea %ld: el producto ya tiene un lote con fecha %d, no se puede procesar.\n", line, date);
+    else
+        printf("Manifiesto línea %ld: fila inválida, se omite.\n", line);
+}
+
+// ---------------------------------------------------------------------------
+// Snapshot binario (enteros de 32 bits en el orden de bytes de la máquina):
+//   cabecera  "LOGSNAP1", versión, #cadenas, #lotes, #pedidos, último id
+//   cadenas   por cada id: longitud + bytes
+//   lotes     agrupados por producto y en orden de fecha dentro de cada uno
+//             (versión 1: un solo orden de fecha): fecha, producto, stock,
+//             #pedidos y luego cada pedido de la cola: id, destino, cantidad
+// Se carga con mmap y cada AVL se reconstruye en O(n) con inventory_rebuild.
+// ---------------------------------------------------------------------------
+
+#define SNAPSHOT_MAGIC "LOGSNAP1"
+#define SNAPSHOT_VERSION 2
+
+void put_u32(FILE *fp, unsigned v) { fwrite(&v, sizeof(v), 1, fp); }
+
+// Write the whole state to path (through a temporary file + rename)
+int snapshot_save(Catalog *cat, const char *path) {
+    char tmp[1024];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) return 0;
+    FILE *fp = fopen(tmp, "wb");
+    if (!fp) return 0;
+    setvbuf(fp, NULL, _IOFBF, 1 << 20);
+    fwrite(SNAPSHOT_MAGIC, 1, 8, fp);
+    put_u32(fp, SNAPSHOT_VERSION);
+    put_u32(fp, (unsigned)strings.count);
+    long long orders = 0;
+    for (int i = 0; i < cat->cap; i++)
+        if (cat->shards[i]) orders += total_orders(cat->shards[i]->root);
+    put_u32(fp, (unsigned)catalog_lot_count(cat));
+    put_u32(fp, (unsigned)orders);
+    put_u32(fp, (unsigned)order_index.next_id);
+    for (int id = 0; id < strings.count; id++) {
+        unsigned len = (unsigned)strlen(strings.names[id]);
+        put_u32(fp, len);
+        fwrite(strings.names[id], 1, len, fp);
+    }
+    for (int i = 0; i < cat->cap; i++) {
+        Inventory *inv = cat->shards[i];
+        for (AVLNode *n = inv ? earliest_lot(inv) : NULL; n; n = next_lot(inv, n)) {
+            unsigned rec[4] = {(unsigned)n->date, (unsigned)n->product_id, (unsigned)n->stock, (unsigned)n->order_count};
+            fwrite(rec, sizeof(unsigned), 4, fp);
+            for (OrderChunk *c = n->head; c; c = c->next) {
+                for (int k = c->begin; k < c->end; k++) {
+                    if (!c->id[k]) continue;
+                    unsigned ord[3] = {(unsigned)c->id[k], (unsigned)c->dest_id[k], (unsigned)c->quantity[k]};
+                    fwrite(ord, sizeof(unsigned), 3, fp);
+                }
+            }
+        }
+    }
+    int ok = !ferror(fp);
+    if (fclose(fp) != 0) ok = 0;
+#ifdef _WIN32
+    if (ok) remove(path);
+#endif
+    if (!ok || rename(tmp, path) != 0) { remove(tmp); return 0; }
+    return 1;
+}
+
+// Map (or read) a whole file; *mapped tells whether to munmap or free it
+const unsigned char *map_file(const char *path, size_t *size, int *mapped) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return NULL;
+    *mapped = 0;
+#ifndef _WIN32
+    struct stat st;
+    if (fstat(fileno(fp), &st) == 0 && st.st_size > 0) {
+        void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+        if (p != MAP_FAILED) {
+            fclose(fp);
+            *size = (size_t)st.st_size;
+            *mapped = 1;
+            return p;
+        }
+    }
+#endif
+    char *buf = read_all(fp, size);
+    fclose(fp);
+    return (const unsigned char *)buf;
+}
+
+void unmap_file(const unsigned char *data, size_t size, int mapped) {
+#ifndef _WIN32
+    if (mapped) { munmap((void *)data, size); return; }
+#endif
+    (void)size; (void)mapped;
+    free((void *)data);
+}
+
+// Bounds-checked reader over the mapped snapshot
+typedef struct SnapReader {
+    const unsigned char *p;
+    const unsigned char *end;
+} SnapReader;
+
+int get_u32(SnapReader *r, unsigned *v) {
+    if (r->end - r->p < 4) return 0;
+    memcpy(v, r->p, 4);
+    r->p += 4;
+    return 1;
+}
+
+// Rebuild every product's tree from nodes[0..n): a stable counting sort by
+// product keeps each product's lots in file order, which must be by date.
+// Returns 0 (nothing built) if the order is wrong or memory runs out.
+int catalog_rebuild(Catalog *cat, AVLNode **nodes, long n) {
+    AVLNode **sorted = malloc(sizeof(AVLNode *) * (size_t)(n ? n : 1));
+    long *count = calloc((size_t)strings.count + 1, sizeof(long));
+    int ok = sorted && count;
+    for (long i = 0; ok && i < n; i++) count[nodes[i]->product_id + 1]++;
+    for (int b = 0; ok && b < strings.count; b++) count[b + 1] += count[b];
+    for (long i = 0; ok && i < n; i++) sorted[count[nodes[i]->product_id]++] = nodes[i];
+    for (long i = 1; ok && i < n; i++)
+        if (sorted[i]->product_id == sorted[i - 1]->product_id && sorted[i]->date <= sorted[i - 1]->date) ok = 0;
+    for (long from = 0, to; ok && from < n; from = to) {
+        for (to = from + 1; to < n && sorted[to]->product_id == sorted[from]->product_id; to++) {}
+        ok = catalog_shard(cat, sorted[from]->product_id) != NULL;
+    }
+    for (long from = 0, to; ok && from < n; from = to) {
+        for (to = from + 1; to < n && sorted[to]->product_id == sorted[from]->product_id; to++) {}
+        inventory_rebuild(catalog_get(cat, sorted[from]->product_id), sorted + from, to - from);
+    }
+    free(count);
+    free(sorted);
+    return ok;
+}
+
+// Load a snapshot into an empty catalog. Returns 1 on success, 0 if the
+// file does not exist, -1 if it is corrupt (the catalog stays empty).
+int snapshot_load(Catalog *cat, const char *path) {
+    size_t size = 0;
+    int mapped = 0;
+    const unsigned char *data = map_file(path, &size, &mapped);
+    if (!data) return 0;
+    SnapReader rd = {data, data + size};
+    unsigned version, nstrings, nlots, norders, last_id;
+    int *remap = NULL;
+    AVLNode **nodes = NULL;
+    char *name = NULL;
+    long built = 0;
+    int ok = size >= 8 && memcmp(data, SNAPSHOT_MAGIC, 8) == 0;
+    rd.p += 8;
+    ok = ok && get_u32(&rd, &version) && (version == 1 || version == SNAPSHOT_VERSION) &&
+         get_u32(&rd, &nstrings) && get_u32(&rd, &nlots) &&
+         get_u32(&rd, &norders) && get_u32(&rd, &last_id);
+    if (ok) {
+        remap = malloc(sizeof(int) * (nstrings ? nstrings : 1));
+        nodes = malloc(sizeof(AVLNode *) * (nlots ? nlots : 1));
+        name = malloc((size_t)(rd.end - rd.p) + 1);
+        ok = remap && nodes && name;
+    }
+    // string table: snapshot ids are remapped in case names already exist
+    for (unsigned i = 0; ok && i < nstrings; i++) {
+        unsigned len;
+        ok = get_u32(&rd, &len) && (size_t)(rd.end - rd.p) >= len;
+        if (!ok) break;
+        memcpy(name, rd.p, len);
+        name[len] = '\0';
+        rd.p += len;
+        remap[i] = intern(name);
+        ok = remap[i] >= 0;
+    }
+    for (unsigned i = 0; ok && i < nlots; i++) {
+        unsigned rec[4];
+        ok = get_u32(&rd, &rec[0]) && get_u32(&rd, &rec[1]) && get_u32(&rd, &rec[2]) &&
+             get_u32(&rd, &rec[3]) && rec[1] < nstrings;
+        AVLNode *node = ok ? new_node_id((int)rec[0], remap[rec[1]], (int)rec[2]) : NULL;
+        if (!node) { ok = 0; break; }
+        nodes[built++] = node;
+        for (unsigned k = 0; ok && k < rec[3]; k++) {
+            unsigned ord[3];
+            ok = get_u32(&rd, &ord[0]) && get_u32(&rd, &ord[1]) && get_u32(&rd, &ord[2]) &&
+                 (int)ord[0] > 0 && ord[1] < nstrings && !order_index_find((int)ord[0]);
+            int slot;
+            OrderChunk *c = ok ? queue_push(node, (int)ord[0], remap[ord[1]], (int)ord[2], stats_now_ns(), &slot) : NULL;
+            if (!c) { ok = 0; break; }
+            if (!order_index_add((int)ord[0], c, slot)) { queue_remove(c, slot); ok = 0; break; }
+        }
+    }
+    ok = ok && catalog_rebuild(cat, nodes, built);
+    if (ok) {
+        if ((int)last_id > order_index.next_id) order_index.next_id = (int)last_id;
+    } else {
+        for (long i = 0; i < built; i++) {
+            free_order_list(nodes[i]->head);
+            pool_free(&node_pool, nodes[i]);
+        }
+    }
+    free(remap);
+    free(nodes);
+    free(name);
+    unmap_file(data, size, mapped);
+    return ok ? 1 : -1;
+}
+
+// Open (append) the journal that records operations after recovery
+int journal_open(const char *path) {
+    journal.fp = fopen(path, "ab");
+    if (!journal.fp) return 0;
+    journal.scope = JOURNAL_SCOPE_UNKNOWN; // the file may end in any scope
+    setvbuf(journal.fp, NULL, _IOFBF, 1 << 16);
+    return 1;
+}
+
+const char *journal_path;
+const char *snapshot_path;
+
+// Save a snapshot and start a fresh journal: the snapshot now covers it all
+int checkpoint(Catalog *cat, const char *path) {
+    if (!path) return 0;
+    journal_flush();
+    if (!snapshot_save(cat, path)) return 0;
+    if (journal.fp && journal_path) {
+        fclose(journal.fp);
+        journal.fp = fopen(journal_path, "wb");
+        journal.scope = JOURNAL_SCOPE_UNKNOWN;
+        if (journal.fp) setvbuf(journal.fp, NULL, _IOFBF, 1 << 16);
+        // the snapshot holds no clock: restart the journal with it
+        if (expiry.today != INT_MIN) journal_int("CLOCK", expiry.today);
+    }
+    return 1;
+}
+
+void out_lot(OutBuf *o, AVLNode *n) {
+    out_str(o, "LOT ");
+    out_int(o, n->date);
+    out_char(o, ' ');
+    out_str(o, intern_name(n->product_id));
+    out_str(o, " stock=");
+    out_int(o, lot_stock(n));
+    out_str(o, " pedidos=");
+    out_int(o, n->order_count);
+    out_char(o, '\n');
+}
+
+// One product's lots, or every product merged by date when scope is NULL
+void out_report(OutBuf *o, Catalog *cat, Inventory *scope) {
+    if (scope) {
+        LotScan sc;
+        for (AVLNode *n = scan_first(scope, &sc); n; n = scan_next(scope, &sc)) out_lot(o, n);
+        return;
+    }
+    CatalogScan cs;
+    for (AVLNode *n = catalog_scan_first(cat, &cs); n; n = catalog_scan_next(&cs)) out_lot(o, n);
+    catalog_scan_end(&cs);
+}
+
+// Longest order queue over all lots (O(n) scan, only for STATS)
+int longest_queue(Inventory *inv) {
+    int longest = 0;
+    for (AVLNode *n = earliest_lot(inv); n; n = next_lot(inv, n))
+        if (n->order_count > longest) longest = n->order_count;
+    return longest;
+}
+
+// One "LAT" line: count, average, p50/p99, max and the non-empty buckets
+void out_latency(OutBuf *o, const char *name, const LatencyHist *h) {
+    if (!h->count) return;
+    out_str(o, "LAT "); out_str(o, name);
+    out_str(o, " n="); out_int(o, h->count);
+    out_str(o, " avg_ns="); out_int(o, h->total_ns / h->count);
+    out_str(o, " p50_ns="); out_int(o, latency_percentile(h, 50));
+    out_str(o, " p99_ns="); out_int(o, latency_percentile(h, 99));
+    out_str(o, " max_ns="); out_int(o, h->max_ns);
+    out_str(o, " hist=");
+    int first = 1;
+    for (int b = 0; b < LAT_BUCKETS; b++) {
+        if (!h->buckets[b]) continue;
+        if (!first) out_char(o, ',');
+        out_int(o, b); out_char(o, ':'); out_int(o, h->buckets[b]);
+        first = 0;
+    }
+    out_char(o, '\n');
+}
+
+// Machine-readable stats: one "STATS" line of key=value pairs, then one
+// "LAT" line per operation with its non-empty histogram buckets (b:count)
+void out_stats(OutBuf *o, Catalog *cat) {
+    int products = 0, tallest = 0, longest = 0;
+    long long orders = 0;
+    for (int i = 0; i < cat->cap; i++) {
+        Inventory *inv = cat->shards[i];
+        if (!inv || !inv->root) continue;
+        products++;
+        orders += total_orders(inv->root);
+        tallest = max(tallest, height(inv->root));
+        longest = max(longest, longest_queue(inv));
+    }
+    out_str(o, "STATS t="); out_int(o, (long long)time(NULL));
+    out_str(o, " indice="); out_str(o, LOT_INDEX_NAME);
+    out_str(o, " productos="); out_int(o, products);
+    out_str(o, " lotes="); out_int(o, catalog_lot_count(cat));
+    out_str(o, " altura="); out_int(o, tallest);
+    out_str(o, " pedidos="); out_int(o, orders);
+    out_str(o, " cola_max="); out_int(o, longest);
+    out_str(o, " comparaciones="); out_int(o, tree_stats.comparisons);
+    out_str(o, " rotaciones="); out_int(o, tree_stats.rotations);
+    out_str(o, " pool_allocs="); out_int(o, alloc_stats.pool_allocs);
+    out_str(o, " pool_frees="); out_int(o, alloc_stats.pool_frees);
+    out_str(o, " heap_allocs="); out_int(o, alloc_stats.heap_allocs);
+    out_str(o, " heap_frees="); out_int(o, alloc_stats.heap_frees);
+    out_char(o, '\n');
+
+    // Dispatch pipeline: throughput since the first dispatch and the
+    // enqueue -> shipped latency ("LAT shipped")
+#ifdef CONCURRENT_INTAKE
+    pthread_mutex_lock(&dispatch_pool.lock);
+    DispatchStats ds = dispatch_stats;
+    pthread_mutex_unlock(&dispatch_pool.lock);
+    long long in_flight = dispatch_in_flight();
+    int workers = dispatch_pool.count;
+#else
+    DispatchStats ds = dispatch_stats;
+    long long in_flight = 0;
+    int workers = 0;
+#endif
+    if (ds.started_ns) {
+        long long elapsed = stats_now_ns() - ds.started_ns;
+        out_str(o, "DISPATCH pedidos="); out_int(o, ds.orders);
+        out_str(o, " unidades="); out_int(o, ds.units);
+        out_str(o, " envios="); out_int(o, ds.shipments);
+        out_str(o, " en_cola="); out_int(o, in_flight);
+        out_str(o, " esperas="); out_int(o, ds.stalls);
+        out_str(o, " hilos="); out_int(o, workers);
+        out_str(o, " pedidos_s="); out_int(o, elapsed > 0 ? (long long)(ds.orders * 1e9 / elapsed) : 0);
+        out_char(o, '\n');
+    }
+    // Expiry clock and sweep: lots still expired, what was retired so far
+    // and how long each bounded sweep step took ("LAT expiry")
+    if (expiry.today != INT_MIN) {
+        out_str(o, "EXPIRY hoy="); out_int(o, expiry.today);
+        out_str(o, " reloj="); out_str(o, expiry.real ? "real" : "simulado");
+        out_str(o, " vencidos="); out_int(o, expired_lots(cat));
+        out_str(o, " retirados="); out_int(o, expiry.retired);
+        out_str(o, " movidos="); out_int(o, expiry.moved);
+        out_str(o, " fallidos="); out_int(o, expiry.failed);
+        out_str(o, " unidades_fallidas="); out_int(o, expiry.failed_units);
+        out_char(o, '\n');
+    }
+    for (int op = 0; op < OP_COUNT; op++) out_latency(o, op_names[op], &op_latency[op]);
+    out_latency(o, "shipped", &ds.latency);
+    out_latency(o, "expiry", &expiry.latency);
+}
+
+// Periodic dump (--stats archivo): appends out_stats every stats_every operations
+const char *stats_path = NULL;
+long stats_every = 1000;
+long stats_pending = 0;
+
+void stats_tick(Catalog *cat) {
+    if (!stats_path || ++stats_pending < stats_every) return;
+    stats_pending = 0;
+    FILE *f = fopen(stats_path, "a");
+    if (!f) return;
+    static OutBuf dump;
+    dump.fp = f;
+    dump.len = 0;
+    out_stats(&dump, cat);
+    out_flush(&dump);
+    fclose(f);
+}
+
+// ---------------------------------------------------------------------------
+// Exportación del reporte: CSV o JSON por el escritor con buffer, con filtro
+// por rango de fechas y paginación. El recorrido arranca en la primera fecha
+// del rango (O(log n)) y termina al llenar la página, sin recorrer el resto.
+// ---------------------------------------------------------------------------
+
+enum { EXPORT_CSV, EXPORT_JSON };
+
+typedef struct ExportSpec {
+    int format;
+    int from, to;   // inclusive date range
+    long page_size; // lots per page, 0 for the whole range
+    long page;      // 1-based
+} ExportSpec;
+
+typedef struct ExportResult {
+    long lots;  // lots written on this page
+    long total; // lots in the whole range
+} ExportResult;
+
+// Quoted only when it holds a separator, a quote or a line break
+void out_csv_field(OutBuf *o, const char *s) {
+    if (!strpbrk(s, ",\"\r\n")) { out_str(o, s); return; }
+    out_char(o, '"');
+    for (; *s; s++) {
+        if (*s == '"') out_char(o, '"');
+        out_char(o, *s);
+    }
+    out_char(o, '"');
+}
+
+void out_json_string(OutBuf *o, const char *s) {
+    static const char hex[] = "0123456789abcdef";
+    out_char(o, '"');
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') { out_char(o, '\\'); out_char(o, (char)c); }
+        else if (c < 0x20) { out_str(o, "\\u00"); out_char(o, hex[c >> 4]); out_char(o, hex[c & 15]); }
+        else out_char(o, (char)c);
+    }
+    out_char(o, '"');
+}
+
+void out_export_lot(OutBuf *o, int format, AVLNode *n, int first) {
+    if (format == EXPORT_CSV) {
+        out_int(o, n->date); out_char(o, ',');
+        out_csv_field(o, intern_name(n->product_id)); out_char(o, ',');
+        out_int(o, lot_stock(n)); out_char(o, ',');
+        out_int(o, n->order_count); out_char(o, '\n');
+        return;
+    }
+    out_str(o, first ? "\n{\"fecha\":" : ",\n{\"fecha\":");
+    out_int(o, n->date);
+    out_str(o, ",\"producto\":"); out_json_string(o, intern_name(n->product_id));
+    out_str(o, ",\"stock\":"); out_int(o, lot_stock(n));
+    out_str(o, ",\"pedidos\":"); out_int(o, n->order_count);
+    out_char(o, '}');
+}
+
+// Export one page of the lots dated in [from, to], for one product or for the
+// whole catalog merged by date when scope is NULL. Within one product the page
+// start is a rank lookup on the subtree counts; across products the merged
+// scan skips the earlier pages lot by lot.
+ExportResult export_lots(OutBuf *o, Catalog *cat, Inventory *scope, const ExportSpec *spec) {
+    ExportResult r = {0, 0};
+    RangeTotals range = scope ? totals_between(scope->root, spec->from, spec->to)
+                              : catalog_totals_between(cat, spec->from, spec->to);
+    r.total = range.lots;
+    long skip = spec->page_size > 0 ? (spec->page - 1) * spec->page_size : 0;
+    long limit = spec->page_size > 0 ? spec->page_size : r.total;
+    if (skip > r.total) skip = r.total;
+    if (limit > r.total - skip) limit = r.total - skip;
+
+    if (spec->format == EXPORT_CSV) {
+        out_str(o, "fecha,producto,stock,pedidos\n");
+    } else {
+        // Open ends of the range are written as null
+        out_str(o, "{\"desde\":");
+        if (spec->from == INT_MIN) out_str(o, "null"); else out_int(o, spec->from);
+        out_str(o, ",\"hasta\":");
+        if (spec->to == INT_MAX) out_str(o, "null"); else out_int(o, spec->to);
+        out_str(o, ",\"pagina\":"); out_int(o, spec->page_size > 0 ? spec->page : 1);
+        out_str(o, ",\"por_pagina\":"); out_int(o, spec->page_size);
+        out_str(o, ",\"total\":"); out_int(o, r.total);
+        out_str(o, ",\"lotes\":[");
+    }
+
+    if (limit > 0 && scope) {
+        long rank = totals_before(scope->root, spec->from).lots + skip;
+        AVLNode *start = node_at_rank(scope->root, rank);
+        LotScan sc;
+        for (AVLNode *n = start ? scan_from(scope, &sc, start->date) : NULL; n && r.lots < limit;
+             n = scan_next(scope, &sc))
+            out_export_lot(o, spec->format, n, r.lots++ == 0);
+    } else if (limit > 0) {
+        CatalogScan cs;
+        AVLNode *n = catalog_scan_from(cat, &cs, spec->from);
+        for (long i = 0; n && i < skip; i++) n = catalog_scan_next(&cs);
+        for (; n && r.lots < limit; n = catalog_scan_next(&cs))
+            out_export_lot(o, spec->format, n, r.lots++ == 0);
+        catalog_scan_end(&cs);
+    }
+
+    if (spec->format == EXPORT_JSON) out_str(o, r.lots ? "\n]}\n" : "]}\n");
+    return r;
+}
+
+// Export into a file ("-" or NULL writes to o); returns 0 if it cannot be created
+int export_file(OutBuf *o, Catalog *cat, Inventory *scope, const ExportSpec *spec,
+                const char *path, ExportResult *res) {
+    if (!path || strcmp(path, "-") == 0) {
+        *res = export_lots(o, cat, scope, spec);
+        return 1;
+    }
+    FILE *f = fopen(path, "wb");
+    if (!f) return 0;
+    setvbuf(f, NULL, _IONBF, 0); // OutBuf already writes whole blocks
+    static OutBuf file_out;
+    file_out.fp = f;
+    file_out.len = 0;
+    *res = export_lots(&file_out, cat, scope, spec);
+    out_flush(&file_out);
+    return fclose(f) == 0;
+}
+
+void out_error(OutBuf *o, long line, const char *msg) {
+    out_str(o, "ERR ");
+    out_int(o, line);
+    out_char(o, ' ');
+    out_str(o, msg);
+    out_char(o, '\n');
+}
+
+void out_reject(long line, int date, const char *why, void *ctx) {
+    OutBuf *o = ctx;
+    out_str(o, "ERR LOAD ");
+    out_int(o, line);
+    out_char(o, ' ');
+    out_str(o, why);
+    if (date) { out_char(o, ' '); out_int(o, date); }
+    out_char(o, '\n');
+}
+
+// Execute every command in buf; returns the number of failed commands.
+// PRODUCT <nombre> scopes the following commands to that product's lots;
+// PRODUCT alone goes back to all products.
+long run_batch(Catalog *cat, char *buf, size_t len, OutBuf *o) {
+    const char *p = buf, *end = buf + len;
+    long line = 0, errors = 0;
+    char text[MAX_NAME * 4];
+    Inventory *scope = NULL;
+
+    while (p < end) {
+        const char *eol = memchr(p, '\n', (size_t)(end - p));
+        if (!eol) eol = end;
+        line++;
+        const char *s = skip_spaces(p, eol);
+        const char *next = eol < end ? eol + 1 : end;
+        if (s == eol || *s == '#') { p = next; continue; }
+
+        const char *cmd_end = token_end(s, eol);
+        size_t cmd_len = (size_t)(cmd_end - s);
+        const char *args = skip_spaces(cmd_end, eol);
+        long long t0 = stats_now_ns();
+        int op = -1;
+#ifdef CONCURRENT_INTAKE
+        catalog_write_begin(cat);
+#endif
+
+        if (cmd_len == 4 && memcmp(s, "RECV", 4) == 0) {
+            op = OP_RECV;
+            int date, qty;
+            const char *t1 = token_end(args, eol);
+            const char *a2 = skip_spaces(t1, eol);
+            const char *t2 = token_end(a2, eol);
+            const char *prod = skip_spaces(t2, eol);
+            const char *pend = eol;
+            while (pend > prod && (pend[-1] == ' ' || pend[-1] == '\t' || pend[-1] == '\r')) pend--;
+            size_t plen = (size_t)(pend - prod);
+            if (!parse_int(args, t1, &date) || !parse_int(a2, t2, &qty) || plen == 0 || plen >= sizeof(text)) {
+                out_error(o, line, "RECV requiere: fecha cantidad producto"); errors++;
+            } else {
+                memcpy(text, prod, plen);
+                text[plen] = '\0';
+                if (!catalog_receive(cat, date, text, qty)) { out_error(o, line, "el producto ya tiene un lote con esa fecha"); errors++; }
+                else { out_str(o, "OK RECV "); out_int(o, date); out_char(o, '\n'); }
+            }
+        } else if (cmd_len == 5 && memcmp(s, "ORDER", 5) == 0) {
+            op = OP_ORDER;
+            int qty, parts;
+            if (!split_text_int(args, eol, text, sizeof(text), &qty)) {
+                out_error(o, line, "ORDER requiere: destino cantidad"); errors++;
+            } else if (!(scope ? first_viable_lot(scope) : catalog_earliest(cat))) {
+                out_error(o, line, "no hay lotes disponibles"); errors++;
+            } else {
+                int res = scope ? allocate_order(scope, text, qty, &parts) : catalog_allocate(cat, text, qty, &parts);
+                if (res > 0) {
+                    // one line per lot the order was split across
+                    for (int i = 0; i < parts; i++) {
+                        OrderRef *part = order_index_find(res + i);
+                        out_str(o, "OK ORDER "); out_int(o, part->id);
+                        out_char(o, ' '); out_int(o, part->chunk->lot->date);
+                        out_char(o, ' '); out_int(o, part->chunk->quantity[part->slot]); out_char(o, '\n');
+                    }
+                }
+                else if (res == -1) { out_error(o, line, "no hay stock suficiente"); errors++; }
+                else { out_error(o, line, "error al encolar pedido"); errors++; }
+            }
+        } else if (cmd_len == 7 && memcmp(s, "ENQUEUE", 7) == 0) {
+            op = OP_ORDER;
+            int date, qty;
+            const char *t1 = token_end(args, eol);
+            if (!parse_int(args, t1, &date) ||
+                !split_text_int(skip_spaces(t1, eol), eol, text, sizeof(text), &qty)) {
+                out_error(o, line, "ENQUEUE requiere: fecha destino cantidad"); errors++;
+            } else {
+                int matches = 1;
+                Inventory *target = scope;
+                if (!target) {
+                    AVLNode *lot = catalog_find_date(cat, date, &matches);
+                    target = lot ? catalog_get(cat, lot->product_id) : NULL;
+                }
+                int id = target && matches == 1 ? inventory_enqueue(target, date, text, qty) : 0;
+                if (id > 0) {
+                    out_str(o, "OK ORDER "); out_int(o, id);
+                    out_char(o, ' '); out_int(o, date);
+                    out_char(o, ' '); out_int(o, qty); out_char(o, '\n');
+                }
+                else if (id == -1) { out_error(o, line, "no hay stock suficiente"); errors++; }
+                else if (id == -2) { out_error(o, line, "el lote esta vencido"); errors++; }
+                else if (matches > 1) { out_error(o, line, "varios productos tienen lote en esa fecha (use PRODUCT)"); errors++; }
+                else if (!target || !inventory_find(target, date)) { out_error(o, line, "no se encontro lote con esa fecha"); errors++; }
+                else { out_error(o, line, "error al encolar pedido"); errors++; }
+            }
+        } else if (cmd_len == 4 && memcmp(s, "DROP", 4) == 0) {
+            op = OP_DROP;
+            int date;
+            if (!parse_int(args, token_end(args, eol), &date)) {
+                out_error(o, line, "DROP requiere: fecha"); errors++;
+            } else {
+                if (scope ? inventory_drop(scope, date) : catalog_drop(cat, date)) { out_str(o, "OK DROP "); out_int(o, date); out_char(o, '\n'); }
+                else { out_error(o, line, "no se encontro lote con esa fecha"); errors++; }
+            }
+        } else if (cmd_len == 6 && memcmp(s, "CANCEL", 6) == 0) {
+            op = OP_CANCEL;
+            int date, qty;
+            const char *t1 = token_end(args, eol);
+            if (!parse_int(args, t1, &date) ||
+                !split_text_int(skip_spaces(t1, eol), eol, text, sizeof(text), &qty)) {
+                out_error(o, line, "CANCEL requiere: fecha destino cantidad"); errors++;
+            } else {
+                int found_lot = 0, canceled;
+                if (scope) {
+                    AVLNode *node = inventory_find(scope, date);
+                    found_lot = node != NULL;
+                    canceled = node && cancel_order_in_node(node, text, qty);
+                } else {
+                    canceled = catalog_cancel(cat, date, text, qty, &found_lot);
+                }
+                if (!found_lot) { out_error(o, line, "no se encontro lote con esa fecha"); errors++; }
+                else if (!canceled) { out_error(o, line, "pedido no encontrado"); errors++; }
+                else { out_str(o, "OK CANCEL "); out_int(o, date); out_char(o, '\n'); }
+            }
+        } else if (cmd_len == 8 && memcmp(s, "CANCELID", 8) == 0) {
+            op = OP_CANCEL;
+            int id;
+            if (!parse_int(args, token_end(args, eol), &id)) {
+                out_error(o, line, "CANCELID requiere: id"); errors++;
+            } else if (!cancel_order_by_id(id)) {
+                out_error(o, line, "pedido no encontrado"); errors++;
+            } else { out_str(o, "OK CANCELID "); out_int(o, id); out_char(o, '\n'); }
+        } else if ((cmd_len == 5 && memcmp(s, "QUERY", 5) == 0) ||
+                   (cmd_len == 6 && memcmp(s, "BEFORE", 6) == 0)) {
+            op = OP_QUERY;
+            int from = INT_MIN, to, ok;
+            const char *t1 = token_end(args, eol);
+            if (cmd_len == 5) {
+                const char *a2 = skip_spaces(t1, eol);
+                ok = parse_int(args, t1, &from) && parse_int(a2, token_end(a2, eol), &to);
+            } else {
+                ok = parse_int(args, t1, &to) && to != INT_MIN;
+                to--; // strictly before the given date
+            }
+            if (!ok) {
+                out_error(o, line, cmd_len == 5 ? "QUERY requiere: desde hasta" : "BEFORE requiere: fecha"); errors++;
+            } else {
+                RangeTotals t = scope ? totals_between(scope->root, from, to) : catalog_totals_between(cat, from, to);
+                out_str(o, "OK ");
+                out_write(o, s, cmd_len);
+                out_str(o, " lotes="); out_int(o, t.lots);
+                out_str(o, " stock="); out_int(o, t.stock);
+                out_str(o, " pedidos="); out_int(o, t.orders);
+                out_char(o, '\n');
+            }
+        } else if (cmd_len == 6 && memcmp(s, "EXPIRE", 6) == 0) {
+            op = OP_EXPIRE;
+            int date;
+            if (!parse_int(args, token_end(args, eol), &date)) {
+                out_error(o, line, "EXPIRE requiere: fecha"); errors++;
+            } else {
+                RangeTotals t = scope ? inventory_expire_before(scope, date) : catalog_expire_before(cat, date);
+                out_str(o, "OK EXPIRE lotes="); out_int(o, t.lots);
+                out_str(o, " stock="); out_int(o, t.stock);
+                out_str(o, " pedidos="); out_int(o, t.orders);
+                out_char(o, '\n');
+            }
+        } else if (cmd_len == 4 && memcmp(s, "LOAD", 4) == 0) {
+            op = OP_LOAD;
+            const char *pend = eol;
+            while (pend > args && (pend[-1] == ' ' || pend[-1] == '\t' || pend[-1] == '\r')) pend--;
+            size_t plen = (size_t)(pend - args);
+            ManifestResult res;
+            if (plen == 0 || plen >= sizeof(text)) {
+                out_error(o, line, "LOAD requiere: archivo"); errors++;
+            } else {
+                memcpy(text, args, plen);
+                text[plen] = '\0';
+                if (!load_manifest_file(cat, text, &res, out_reject, o)) {
+                    out_error(o, line, "no se pudo leer el manifiesto"); errors++;
+                } else {
+                    out_str(o, "OK LOAD cargados="); out_int(o, res.loaded);
+                    out_str(o, " duplicados="); out_int(o, res.duplicates);
+                    out_str(o, " invalidos="); out_int(o, res.invalid);
+                    out_char(o, '\n');
+                }
+            }
+        } else if (cmd_len == 8 && memcmp(s, "SNAPSHOT", 8) == 0) {
+            op = OP_SNAPSHOT;
+            const char *pend = eol;
+            while (pend > args && (pend[-1] == ' ' || pend[-1] == '\t' || pend[-1] == '\r')) pend--;
+            size_t plen = (size_t)(pend - args);
+            const char *path = snapshot_path;
+            if (plen && plen < sizeof(text)) {
+                memcpy(text, args, plen);
+                text[plen] = '\0';
+                path = text;
+            }
+            if (!path) { out_error(o, line, "SNAPSHOT requiere: archivo (o --snapshot)"); errors++; }
+            else if (!checkpoint(cat, path)) { out_error(o, line, "no se pudo guardar el snapshot"); errors++; }
+            else { out_str(o, "OK SNAPSHOT "); out_str(o, path); out_char(o, '\n'); }
+        } else if (cmd_len == 6 && memcmp(s, "REPORT", 6) == 0) {
+            op = OP_REPORT;
+            out_report(o, cat, scope);
+            out_str(o, "OK REPORT\n");
+        } else if (cmd_len == 6 && memcmp(s, "EXPORT", 6) == 0) {
+            op = OP_EXPORT;
+            ExportSpec spec = {EXPORT_CSV, INT_MIN, INT_MAX, 0, 1};
+            const char *t1 = token_end(args, eol);
+            const char *a2 = skip_spaces(t1, eol);
+            const char *t2 = token_end(a2, eol);
+            size_t flen = (size_t)(t1 - args), plen = (size_t)(t2 - a2);
+            int ok = plen > 0 && plen < sizeof(text);
+            if (flen == 4 && memcmp(args, "json", 4) == 0) spec.format = EXPORT_JSON;
+            else if (!(flen == 3 && memcmp(args, "csv", 3) == 0)) ok = 0;
+            // Optional numbers: desde hasta [por_pagina [pagina]]
+            int nums[4], count = 0;
+            for (const char *a = skip_spaces(t2, eol); ok && a < eol; a = skip_spaces(a, eol)) {
+                const char *t = token_end(a, eol);
+                if (count == 4 || !parse_int(a, t, &nums[count++])) ok = 0;
+                a = t;
+            }
+            if (count == 1) ok = 0;
+            if (count >= 2) { spec.from = nums[0]; spec.to = nums[1]; }
+            if (count >= 3) spec.page_size = nums[2];
+            if (count == 4) spec.page = nums[3];
+            if (spec.page_size < 0 || spec.page < 1) ok = 0;
+            ExportResult res;
+            if (!ok) {
+                out_error(o, line, "EXPORT requiere: csv|json archivo|- [desde hasta [por_pagina [pagina]]]"); errors++;
+            } else {
+                memcpy(text, a2, plen);
+                text[plen] = '\0';
+                if (!export_file(o, cat, scope, &spec, text, &res)) {
+                    out_error(o, line, "no se pudo escribir la exportacion"); errors++;
+                } else {
+                    out_str(o, "OK EXPORT lotes="); out_int(o, res.lots);
+                    out_str(o, " total="); out_int(o, res.total);
+                    out_char(o, '\n');
+                }
+            }
+        } else if (cmd_len == 8 && memcmp(s, "DISPATCH", 8) == 0) {
+            op = OP_DISPATCH;
+            int max = INT_MAX;
+            if (args < eol && (!parse_int(args, token_end(args, eol), &max) || max <= 0)) {
+                out_error(o, line, "DISPATCH requiere: [cantidad > 0]"); errors++;
+            } else {
+                long long units;
+                int n = dispatch_orders(cat, scope, max, &units);
+                out_str(o, "OK DISPATCH pedidos="); out_int(o, n);
+                out_str(o, " unidades="); out_int(o, units);
+                out_char(o, '\n');
+            }
+        } else if (cmd_len == 4 && memcmp(s, "FEFO", 4) == 0) {
+            AVLNode *n = scope ? first_viable_lot(scope) : catalog_earliest(cat);
+            if (!n) { out_error(o, line, "no hay lotes disponibles"); errors++; }
+            else {
+                out_str(o, "OK FEFO ");
+                out_int(o, n->date); out_char(o, ' ');
+                out_str(o, intern_name(n->product_id));
+                out_str(o, " stock="); out_int(o, lot_stock(n));
+                out_char(o, '\n');
+            }
+        } else if (cmd_len == 7 && memcmp(s, "PRODUCT", 7) == 0) {
+            const char *pend = eol;
+            while (pend > args && (pend[-1] == ' ' || pend[-1] == '\t' || pend[-1] == '\r')) pend--;
+            size_t plen = (size_t)(pend - args);
+            if (plen == 0) {
+                scope = NULL;
+                out_str(o, "OK PRODUCT\n");
+            } else if (plen >= sizeof(text)) {
+                out_error(o, line, "PRODUCT: nombre demasiado largo"); errors++;
+            } else {
+                memcpy(text, args, plen);
+                text[plen] = '\0';
+                Inventory *shard = catalog_shard(cat, intern(text));
+                if (!shard) { out_error(o, line, "sin memoria"); errors++; }
+                else { scope = shard; out_str(o, "OK PRODUCT "); out_str(o, text); out_char(o, '\n'); }
+            }
+        } else if (cmd_len == 5 && memcmp(s, "CLOCK", 5) == 0) {
+            int date;
+            if (args < eol && (!parse_int(args, token_end(args, eol), &date) || !expiry_set_clock(date))) {
+                out_error(o, line, "CLOCK requiere: [fecha no anterior a la actual]"); errors++;
+            } else {
+                out_str(o, "OK CLOCK "); out_int(o, expiry.today == INT_MIN ? 0 : expiry.today);
+                out_str(o, " vencidos="); out_int(o, expired_lots(cat));
+                out_char(o, '\n');
+            }
+        } else if (cmd_len == 6 && memcmp(s, "RETIRE", 6) == 0) {
+            op = OP_EXPIRE;
+            int date, max;
+            const char *t1 = token_end(args, eol);
+            const char *a2 = skip_spaces(t1, eol);
+            if (!parse_int(args, t1, &date) || !parse_int(a2, token_end(a2, eol), &max) || max < 0) {
+                out_error(o, line, "RETIRE requiere: fecha cantidad"); errors++;
+            } else {
+                int matches = 1;
+                AVLNode *lot = scope ? inventory_find(scope, date) : catalog_find_date(cat, date, &matches);
+                if (!lot) { out_error(o, line, "no se encontro lote con esa fecha"); errors++; }
+                else if (matches > 1) { out_error(o, line, "varios productos tienen lote en esa fecha (use PRODUCT)"); errors++; }
+                else if (date >= expiry.today) { out_error(o, line, "el lote no esta vencido"); errors++; }
+                else {
+                    long long moved = expiry.moved, failed = expiry.failed;
+                    retire_lot(catalog_get(cat, lot->product_id), lot, max);
+                    out_str(o, "OK RETIRE "); out_int(o, date);
+                    out_str(o, " movidos="); out_int(o, expiry.moved - moved);
+                    out_str(o, " fallidos="); out_int(o, expiry.failed - failed);
+                    out_char(o, '\n');
+                }
+            }
+        } else if (cmd_len == 5 && memcmp(s, "STATS", 5) == 0) {
+            out_stats(o, cat);
+            out_str(o, "OK STATS\n");
+        } else {
+            out_error(o, line, "comando desconocido"); errors++;
+        }
+        expiry_tick(cat);
+#ifdef CONCURRENT_INTAKE
+        catalog_write_end(cat);
+#endif
+        if (op >= 0) {
+            stats_record(op, t0);
+            stats_tick(cat);
+        }
+        p = next;
+    }
+    out_flush(o);
+    return errors;
+}
+
+// Replay a journal file on top of the current state; returns commands replayed
+long journal_replay(Catalog *cat, const char *path) {
+    FILE *in = fopen(path, "rb");
+    if (!in) return 0;
+    size_t len = 0;
+    char *buf = read_all(in, &len);
+    fclose(in);
+    if (!buf) return 0;
+    static OutBuf sink; // output is discarded
+    sink.fp = NULL;
+    sink.len = 0;
+    journal.suspended = 1;
+    run_batch(cat, buf, len, &sink);
+    journal.suspended = 0;
+    long lines = 0;
+    for (size_t i = 0; i < len; i++) lines += buf[i] == '\n';
+    free(buf);
+    return lines;
+}
+
+// Entry point for --batch [archivo]; "-" or no file reads stdin
+int batch_main(Catalog *cat, const char *path) {
+    FILE *in = stdin;
+    if (path && strcmp(path, "-") != 0) {
+        in = fopen(path, "rb");
+        if (!in) { perror(path); return 1; }
+    }
+    size_t len = 0;
+    char *buf = read_all(in, &len);
+    if (in != stdin) fclose(in);
+    if (!buf) { fprintf(stderr, "Sin memoria para leer la entrada.\n"); return 1; }
+
+    static OutBuf out;
+    out.fp = stdout;
+    out.len = 0;
+    long errors = run_batch(cat, buf, len, &out);
+    journal_flush();
+    if (errors) fprintf(stderr, "Comandos rechazados: %ld\n", errors);
+    free(buf);
+    return 0;
+}
+
+#ifndef FINAL_NO_MAIN
+// Uso: final.exe [--snapshot archivo] [--journal archivo] [--stats archivo [--stats-every N]]
+//                 [--dispatch-workers N] [--clock AAAAMMDD|real] [--load manifiesto]... [--batch [archivo]]
+int main(int argc, char **argv) {
+    Catalog cat;
+    catalog_init(&cat);
+    const char *clock_arg = NULL;
+
+    // Recovery first: last snapshot, then the journal tail recorded after it
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--snapshot") == 0) snapshot_path = argv[++i];
+        else if (strcmp(argv[i], "--clock") == 0) clock_arg = argv[++i];
+        else if (strcmp(argv[i], "--journal") == 0) journal_path = argv[++i];
+        else if (strcmp(argv[i], "--stats") == 0) stats_path = argv[++i];
+        else if (strcmp(argv[i], "--stats-every") == 0 && (stats_every = atol(argv[++i])) <= 0) stats_every = 1;
+#ifdef CONCURRENT_INTAKE
+        else if (strcmp(argv[i], "--dispatch-workers") == 0 && (dispatch_workers = atoi(argv[++i])) <= 0) dispatch_workers = 1;
+#endif
+    }
+    if (snapshot_path) {
+        int rc = snapshot_load(&cat, snapshot_path);
+        if (rc < 0) { fprintf(stderr, "Snapshot %s dañado.\n", snapshot_path); return 1; }
+        if (rc > 0) fprintf(stderr, "Snapshot %s: %d lotes restaurados.\n", snapshot_path, catalog_lot_count(&cat));
+    }
+    if (journal_path) {
+        long replayed = journal_replay(&cat, journal_path);
+        if (replayed) fprintf(stderr, "Journal %s: %ld operaciones re-aplicadas.\n", journal_path, replayed);
+        if (!journal_open(journal_path)) { perror(journal_path); return 1; }
+    }
+    // The clock starts after recovery (the journal may already have moved it)
+    if (clock_arg && strcmp(clock_arg, "real") == 0) {
+        expiry.real = 1;
+        expiry_refresh();
+    } else if (clock_arg && !expiry_set_clock(atoi(clock_arg))) {
+        fprintf(stderr, "Reloj: %s es anterior a la fecha ya registrada (%d).\n", clock_arg, expiry.today);
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "--snapshot") == 0 || strcmp(argv[i], "--journal") == 0 ||
+             strcmp(argv[i], "--stats") == 0 || strcmp(argv[i], "--stats-every") == 0 ||
+             strcmp(argv[i], "--dispatch-workers") == 0 || strcmp(argv[i], "--clock") == 0) && i + 1 < argc) {
+            i++;
+        } else if (strcmp(argv[i], "--load") == 0 && i + 1 < argc) {
+            ManifestResult res;
+            if (!load_manifest_file(&cat, argv[++i], &res, print_reject, NULL)) {
+                perror(argv[i]);
+                continue;
+            }
+            printf("Manifiesto %s: %ld lotes cargados, %ld duplicados, %ld inválidos.\n",
+                   argv[i], res.loaded, res.duplicates, res.invalid);
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            int rc = batch_main(&cat, i + 1 < argc ? argv[i + 1] : NULL);
+#ifdef CONCURRENT_INTAKE
+            dispatch_stop();
+#endif
+            if (journal.fp) fclose(journal.fp);
+            catalog_free(&cat);
+            memory_release();
+            return rc;
+        } else {
+            fprintf(stderr, "Uso: %s [--snapshot archivo] [--journal archivo] [--stats archivo [--stats-every N]] "
+                            "[--dispatch-workers N] [--clock AAAAMMDD|real] [--load manifiesto]... [--batch [archivo]]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    int choice = 0;
+    static OutBuf screen; // buffered console writer for stats and exports
+    screen.fp = stdout;
+    char buf[256];
+
+    while (1) {
+        journal_flush(); // the previous operation is durable before the next prompt
+        printf("\n--- Sistema Logístico - Puerto Buenaventura ---\n");
+        printf("1) Recepción de Mercancía (Insertar en AVL)\n");
+        printf("2) Registrar Pedido de Despacho (FEFO: lotes más cercanos a vencer primero)\n");
+        printf("3) Baja de Producto (Eliminar lote por fecha)\n");
+        printf("4) Cancelar Pedido (Eliminar pedido específico)\n");
+        printf("5) Reporte de Estado (In-Order)\n");
+        printf("6) Consulta de Stock y Pedidos por Rango de Fechas\n");
+        printf("7) Purga de Vencidos (Eliminar lotes anteriores a una fecha)\n");
+        printf("8) Carga Masiva desde Manifiesto (fecha,producto,stock)\n");
+        printf("9) Guardar Snapshot (estado completo en disco)\n");
+        printf("10) Estadísticas (árbol, colas, memoria y latencias)\n");
+        printf("11) Exportar Reporte (CSV/JSON por rango de fechas y páginas)\n");
+        printf("12) Despachar Pedidos (lotes más próximos a vencer, agrupados por destino)\n");
+        printf("13) Reloj de Vencimientos (fecha simulada y retiro automático de vencidos)\n");
+        printf("14) Salir\n");
+        printf("Elija una opción: ");
+        if (!fgets(buf, sizeof(buf), stdin)) break;
+        choice = atoi(buf);
+        if (choice == 1) {
+            printf("Ingrese fecha de vencimiento (AAAAMMDD): ");
+            int date; if (scanf("%d", &date) != 1) { while(getchar()!='\n'); printf("Entrada inválida.\n"); continue; }
+            while(getchar()!='\n');
+            printf("Ingrese cantidad (stock): "); int qty; if (scanf("%d", &qty) != 1) { while(getchar()!='\n'); printf("Entrada inválida.\n"); continue; }
+            while(getchar()!='\n');
+            printf("Ingrese nombre del producto: "); read_line(buf, sizeof(buf));
+            long long t0 = stats_now_ns();
+            int ok = catalog_receive(&cat, date, buf, qty);
+            stats_record(OP_RECV, t0);
+            if (!ok) printf("Error: el producto ya tiene un lote con esa fecha, no se puede procesar.\n");
+            else printf("Lote agregado correctamente.\n");
+        } else if (choice == 2) {
+            int unknown;
+            Inventory *scope = ask_product(&cat, buf, sizeof(buf), &unknown);
+            AVLNode *node = unknown ? NULL : scope ? first_viable_lot(scope) : catalog_earliest(&cat);
+            if (!node) { printf("No hay lotes disponibles.\n"); continue; }
+            printf("Lote más próximo a vencer: %s (Fecha %08d) Stock: %d\n", intern_name(node->product_id), node->date, node->stock);
+            printf("Ingrese destino: "); read_line(buf, sizeof(buf));
+            printf("Ingrese cantidad solicitada: "); int qty; if (scanf("%d", &qty) != 1) { while(getchar()!='\n'); printf("Entrada inválida.\n"); continue; }
+            while(getchar()!='\n');
+            int parts = 0;
+            long long t0 = stats_now_ns();
+            int res = scope ? allocate_order(scope, buf, qty, &parts) : catalog_allocate(&cat, buf, qty, &parts);
+            stats_record(OP_ORDER, t0);
+            if (res == -1) printf("No hay stock suficiente para ese pedido.\n");
+            else if (res > 0) {
+                printf("Pedido encolado correctamente en %d lote(s):\n", parts);
+                for (int i = 0; i < parts; i++) {
+                    OrderRef *part = order_index_find(res + i);
+                    AVLNode *lot = part->chunk->lot;
+                    printf("  ID %d | Fecha %08d | Producto: %s | Cantidad: %d\n", part->id, lot->date,
+                           intern_name(lot->product_id), part->chunk->quantity[part->slot]);
+                }
+            }
+            else printf("Error al encolar pedido.\n");
+        } else if (choice == 3) {
+            printf("Ingrese fecha del lote a eliminar (AAAAMMDD): "); int date; if (scanf("%d", &date) != 1) { while(getchar()!='\n'); printf("Entrada inválida.\n"); continue; }
+            while(getchar()!='\n');
+            int unknown;
+            Inventory *scope = ask_product(&cat, buf, sizeof(buf), &unknown);
+            if (unknown) { printf("No se encontró lote con esa fecha.\n"); continue; }
+            long long t0 = stats_now_ns();
+            int ok = scope ? inventory_drop(scope, date) : catalog_drop(&cat, date);
+            stats_record(OP_DROP, t0);
+            if (ok) printf("%d lote(s) eliminado(s) correctamente (se liberó su cola).\n", ok);
+            else printf("No se encontró lote con esa fecha.\n");
+        } else if (choice == 4) {
+            printf("Ingrese fecha del lote donde está el pedido (AAAAMMDD): "); int date; if (scanf("%d", &date) != 1) { while(getchar()!='\n'); printf("Entrada inválida.\n"); continue; }
+            while(getchar()!='\n');
+            int lots = 0, idx = 1;
+            for (int i = 0; i < cat.cap; i++) {
+                AVLNode *node = cat.shards[i] ? inventory_find(cat.shards[i], date) : NULL;
+                if (!node) continue;
+                if (!lots++) printf("Pedidos actuales en esa fecha:\n");
+                for (OrderChunk *c = node->head; c; c = c->next) {
+                    for (int k = c->begin; k < c->end; k++) {
+                        if (!c->id[k]) continue;
+                        printf("%d) ID: %d | Producto: %s | Destino: %s | Cantidad: %d\n", idx++, c->id[k],
+                               intern_name(node->product_id), intern_name(c->dest_id[k]), c->quantity[k]);
+                    }
+                }
+            }
+            if (!lots) { printf("No se encontró lote con esa fecha.\n"); continue; }
+            if (idx == 1) { printf("No hay pedidos en esa fecha.\n"); continue; }
+            printf("Ingrese ID del pedido a cancelar (0 para buscar por destino y cantidad): ");
+            int id; if (scanf("%d", &id) != 1) { while(getchar()!='\n'); printf("Entrada inválida.\n"); continue; }
+            while(getchar()!='\n');
+            if (id != 0) {
+                OrderRef *r = order_index_find(id);
+                if (r && r->chunk->lot->date == date) {
+                    long long t0 = stats_now_ns();
+                    cancel_order_by_id(id);
+                    stats_record(OP_CANCEL, t0);
+                    printf("Pedido cancelado y stock restaurado.\n");
+                }
+                else printf("Pedido no encontrado en la cola.\n");
+                continue;
+            }
             printf("Ingrese destino del pedido a cancelar: "); read_line(buf, sizeof(buf));
             printf("Ingrese cantidad del pedido a cancelar: "); int qty; if (scanf("%d", &qty) != 1) { while(getchar()!='\n'); printf("Entrada inválida.\n"); continue; }
             while(getchar()!='\n');
-            int canceled = cancel_order_in_node(node, buf, qty);
+            long long t0 = stats_now_ns();
+            int found_lot;
+            int canceled = catalog_cancel(&cat, date, buf, qty, &found_lot);
+            stats_record(OP_CANCEL, t0);
             if (canceled) printf("Pedido cancelado y stock restaurado.\n");
             else printf("Pedido no encontrado en la cola.\n");
         } else if (choice == 5) {
+            int unknown;
+            Inventory *scope = ask_product(&cat, buf, sizeof(buf), &unknown);
+            if (unknown) { printf("Ese producto no tiene lotes.\n"); continue; }
             printf("\n--- Reporte de Estado (ordenado por fecha: más próxima a vencer primero) ---\n");
-            report_inorder(root);
+            long long t0 = stats_now_ns();
+            if (scope) report_inorder(stdout, scope);
+            else catalog_report(stdout, &cat);
+            stats_record(OP_REPORT, t0);
         } else if (choice == 6) {
+            printf("Ingrese fecha inicial (AAAAMMDD): "); int from; if (scanf("%d", &from) != 1) { while(getchar()!='\n'); printf("Entrada inválida.\n"); continue; }
+            while(getchar()!='\n');
+            printf("Ingrese fecha final (AAAAMMDD): "); int to; if (scanf("%d", &to) != 1) { while(getchar()!='\n'); printf("Entrada inválida.\n"); continue; }
+            while(getchar()!='\n');
+            int unknown;
+            Inventory *scope = ask_product(&cat, buf, sizeof(buf), &unknown);
+            long long t0 = stats_now_ns();
+            RangeTotals t = {0, 0, 0};
+            if (!unknown) t = scope ? totals_between(scope->root, from, to) : catalog_totals_between(&cat, from, to);
+            stats_record(OP_QUERY, t0);
+            printf("Lotes: %d | Stock disponible: %lld | Pedidos en espera: %lld\n", t.lots, t.stock, t.orders);
+        } else if (choice == 7) {
+            printf("Ingrese fecha límite (se eliminan los lotes anteriores, AAAAMMDD): "); int date; if (scanf("%d", &date) != 1) { while(getchar()!='\n'); printf("Entrada inválida.\n"); continue; }
+            while(getchar()!='\n');
+            int unknown;
+            Inventory *scope = ask_product(&cat, buf, sizeof(buf), &unknown);
+            long long t0 = stats_now_ns();
+            RangeTotals t = {0, 0, 0};
+            if (!unknown) t = scope ? inventory_expire_before(scope, date) : catalog_expire_before(&cat, date);
+            stats_record(OP_EXPIRE, t0);
+            printf("Lotes eliminados: %d | Stock descartado: %lld | Pedidos descartados: %lld\n", t.lots, t.stock, t.orders);
+        } else if (choice == 8) {
+            printf("Ingrese ruta del manifiesto: "); read_line(buf, sizeof(buf));
+            ManifestResult res;
+            long long t0 = stats_now_ns();
+            int ok = load_manifest_file(&cat, buf, &res, print_reject, NULL);
+            stats_record(OP_LOAD, t0);
+            if (!ok) { printf("No se pudo leer el manifiesto.\n"); continue; }
+            printf("Lotes cargados: %ld | Duplicados rechazados: %ld | Filas inválidas: %ld\n", res.loaded, res.duplicates, res.invalid);
+        } else if (choice == 9) {
+            const char *path = snapshot_path;
+            if (!path) { printf("Ingrese ruta del snapshot: "); read_line(buf, sizeof(buf)); path = buf; }
+            long long t0 = stats_now_ns();
+            int ok = checkpoint(&cat, path);
+            stats_record(OP_SNAPSHOT, t0);
+            if (ok) printf("Snapshot guardado en %s.\n", path);
+            else printf("No se pudo guardar el snapshot.\n");
+        } else if (choice == 10) {
+            out_stats(&screen, &cat);
+            out_flush(&screen);
+            continue;
+        } else if (choice == 11) {
+            ExportSpec spec = {EXPORT_CSV, INT_MIN, INT_MAX, 0, 1};
+            printf("Formato (csv/json): "); read_line(buf, sizeof(buf));
+            if (strcmp(buf, "json") == 0) spec.format = EXPORT_JSON;
+            else if (strcmp(buf, "csv") != 0) { printf("Formato inválido.\n"); continue; }
+            printf("Ingrese fecha inicial (AAAAMMDD, 0 = sin límite): "); int from; if (scanf("%d", &from) != 1) { while(getchar()!='\n'); printf("Entrada inválida.\n"); continue; }
+            while(getchar()!='\n');
+            printf("Ingrese fecha final (AAAAMMDD, 0 = sin límite): "); int to; if (scanf("%d", &to) != 1) { while(getchar()!='\n'); printf("Entrada inválida.\n"); continue; }
+            while(getchar()!='\n');
+            printf("Lotes por página (0 = todos): "); int size; if (scanf("%d", &size) != 1 || size < 0) { while(getchar()!='\n'); printf("Entrada inválida.\n"); continue; }
+            while(getchar()!='\n');
+            int page = 1;
+            if (size > 0) {
+                printf("Página: "); if (scanf("%d", &page) != 1 || page < 1) { while(getchar()!='\n'); printf("Entrada inválida.\n"); continue; }
+                while(getchar()!='\n');
+            }
+            if (from) spec.from = from;
+            if (to) spec.to = to;
+            spec.page_size = size;
+            spec.page = page;
+            int unknown;
+            Inventory *scope = ask_product(&cat, buf, sizeof(buf), &unknown);
+            if (unknown) { printf("Ese producto no tiene lotes.\n"); continue; }
+            char path[MAX_NAME * 4];
+            printf("Ingrese ruta del archivo (ENTER = pantalla): "); read_line(path, sizeof(path));
+            ExportResult res;
+            long long t0 = stats_now_ns();
+            int ok = export_file(&screen, &cat, scope, &spec, path[0] ? path : NULL, &res);
+            out_flush(&screen);
+            stats_record(OP_EXPORT, t0);
+            if (ok) printf("Lotes exportados: %ld de %ld en el rango.\n", res.lots, res.total);
+            else printf("Error: no se pudo escribir %s\n", path);
+        } else if (choice == 12) {
+            printf("Cantidad de pedidos a despachar (0 = todos): "); int max; if (scanf("%d", &max) != 1 || max < 0) { while(getchar()!='\n'); printf("Entrada inválida.\n"); continue; }
+            while(getchar()!='\n');
+            int unknown;
+            Inventory *scope = ask_product(&cat, buf, sizeof(buf), &unknown);
+            if (unknown) { printf("Ese producto no tiene lotes.\n"); continue; }
+            long long units;
+            long long t0 = stats_now_ns();
+            int n = dispatch_orders(&cat, scope, max ? max : INT_MAX, &units);
+            stats_record(OP_DISPATCH, t0);
+            if (n) printf("Pedidos despachados: %d (%lld unidades).\n", n, units);
+            else printf("No hay pedidos en espera.\n");
+        } else if (choice == 13) {
+            if (expiry.today == INT_MIN) printf("Reloj sin fijar: ningún lote vence.\n");
+            else printf("Fecha actual: %08d (%s) | Lotes vencidos por retirar: %d\n", expiry.today,
+                        expiry.real ? "reloj del sistema" : "simulada", expired_lots(&cat));
+            printf("Ingrese nueva fecha (AAAAMMDD, 0 = no cambiar): "); int date; if (scanf("%d", &date) != 1) { while(getchar()!='\n'); printf("Entrada inválida.\n"); continue; }
+            while(getchar()!='\n');
+            if (date && !expiry_set_clock(date)) { printf("Error: el reloj no puede retroceder.\n"); continue; }
+            printf("Retirados: %lld lotes | Pedidos movidos: %lld | Pedidos fallidos: %lld (%lld unidades)\n",
+                   expiry.retired, expiry.moved, expiry.failed, expiry.failed_units);
+        } else if (choice == 14) {
             break;
         } else {
             printf("Opción inválida.\n");
+            continue;
         }
+        expiry_tick(&cat);
+        stats_tick(&cat);
     }
 
-    free_tree(root);
+#ifdef CONCURRENT_INTAKE
+    dispatch_stop();
+#endif
+    if (journal.fp) fclose(journal.fp);
+    catalog_free(&cat);
+    memory_release();
     printf("Saliendo y liberando memoria.\n");
     return 0;
 }
+#endif // FINAL_NO_MAIN
@@ -0,0 +1,280 @@
+/*
+ * Benchmark del Sistema de Tiquetes.
+ * Enlaza taller.c sin su menú e inserta documentos secuenciales (el caso que
+ * convierte un ABB sin balancear en una lista) midiendo la latencia de
+ * inserción por tramos de 10x hasta el total pedido; como referencia hace lo
+ * mismo con un ABB sin balancear hasta 20000 pasajeros. Compara listar un
+ * destino por su índice secundario con recorrer todo el árbol, y simula una
+ * ventana de ventas (reservas y cancelaciones al azar) y muestra cuántos nodos
+ * salieron de la lista libre del pool. Al final mide la verificación de
+ * documentos en el abordaje: búsqueda en el árbol contra el índice congelado,
+ * uno por uno y en lotes, y la carga masiva desde CSV (ordenar y armar el
+ * árbol balanceado) contra registrar fila por fila, más la exportación, y
+ * comprueba que una última fila sin salto de línea se importe bien.
+ *
+ * Compilar: gcc -O2 bench.c -o bench.exe
+ * Ejecutar: ./bench.exe [pasajeros]   (por defecto 10000000)
+ */
+
+#define TALLER_NO_MAIN
+#include "taller.c"
+
+#include <time.h>
+
+double now_seconds(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//Generador xorshift con semilla fija: corridas reproducibles
+unsigned long long bench_rng_state = 88172645463325252ULL;
+
+unsigned long long bench_rand(void) {
+	unsigned long long x = bench_rng_state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return bench_rng_state = x;
+}
+
+int tree_height(Node *root) {
+	if (!root) return 0;
+	int l = tree_height(root->left), r = tree_height(root->right);
+	return 1 + (l > r ? l : r);
+}
+
+//ABB sin balancear (la inserción original, sin recursión) como referencia
+typedef struct PlainNode {
+	Pasajero info;
+	struct PlainNode *left;
+	struct PlainNode *right;
+} PlainNode;
+
+int plain_insert(PlainNode **root, Pasajero p) {
+	while (*root) {
+		if (p.documento < (*root)->info.documento) root = &(*root)->left;
+		else if (p.documento > (*root)->info.documento) root = &(*root)->right;
+		else return 0;
+	}
+	PlainNode *n = (PlainNode *)malloc(sizeof(PlainNode));
+	if (!n) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	n->info = p;
+	n->left = n->right = NULL;
+	*root = n;
+	return 1;
+}
+
+void plain_free(PlainNode *root) {
+	while (root) { /* documentos secuenciales: cada nodo solo tiene hijo derecho */
+		PlainNode *next = root->right;
+		plain_free(root->left);
+		free(root);
+		root = next;
+	}
+}
+
+Pasajero pasajero_n(int documento) {
+	Pasajero p;
+	p.documento = documento;
+	p.destino = (unsigned char)(documento % DEST_COUNT);
+	p.tipo_pasaje = 1 + documento % 2;
+	return p;
+}
+
+//Ventana de ventas: passengers reservas iniciales y luego ops operaciones,
+//mitad reservas y mitad cancelaciones de documentos al azar
+void bench_churn(long passengers, long ops) {
+	Node *root = NULL;
+	int range = (int)(passengers * 2);
+	for (long i = 0; i < passengers; i++) insert_node(&root, pasajero_n(1 + (int)(bench_rand() % range)));
+	double t0 = now_seconds();
+	for (long i = 0; i < ops; i++) {
+		int doc = 1 + (int)(bench_rand() % range);
+		if (i % 2 == 0) {
+			insert_node(&root, pasajero_n(doc));
+		} else {
+			int deleted = 0;
+			root = delete_node(root, doc, &deleted);
+		}
+	}
+	double elapsed = now_seconds() - t0;
+	printf("\nVentana de ventas: %ld reservas/cancelaciones sobre ~%ld pasajeros\n", ops, passengers);
+	printf("%.1f ns/op, %d pasajeros al final, altura %d\n", elapsed * 1e9 / ops, count_nodes(root), tree_height(root));
+	print_pool_stats();
+	free_tree(root);
+}
+
+//"¿Quién va a Tumaco?": recorrido del índice secundario contra recorrer
+//todo el árbol en inorden filtrando por destino
+void bench_destino(Node *root, int destino) {
+	long long sum_index = 0, sum_tree = 0;
+	long hits = 0;
+	double t0 = now_seconds();
+	for (int t = 0; t < TIPO_COUNT; t++) {
+		Indice *ix = &indices[destino][t];
+		for (int i = 0; i < ix->count; i++) sum_index += ix->nodos[i]->info.documento;
+	}
+	double by_index = now_seconds() - t0;
+	t0 = now_seconds();
+	for (Node *n = find_min(root); n; n = next_inorder(n)) {
+		if (n->info.destino != destino) continue;
+		sum_tree += n->info.documento;
+		hits++;
+	}
+	double by_tree = now_seconds() - t0;
+	printf("Pasajeros a %s: %d (índice: %.1f ms, recorrido completo: %.1f ms)%s\n", destinos[destino],
+		   count_destino(destino), by_index * 1e3, by_tree * 1e3,
+		   sum_index == sum_tree && hits == count_destino(destino) ? "" : " INCONSISTENTE");
+}
+
+//Abordaje: lookups documentos al azar (la mitad registrados) sobre
+//passengers pasajeros, con find_node, frozen_find y frozen_find_batch
+void bench_lookup(long passengers, long lookups) {
+	Node *root = NULL;
+	int range = (int)(passengers * 2);
+	for (long i = 0; i < passengers; i++) insert_node(&root, pasajero_n(1 + (int)(bench_rand() % range)));
+	int *docs = (int *)malloc(lookups * sizeof(int));
+	Node **out = (Node **)malloc(lookups * sizeof(Node *));
+	if (!docs || !out) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	for (long i = 0; i < lookups; i++) docs[i] = 1 + (int)(bench_rand() % range);
+
+	double t0 = now_seconds();
+	long hits_tree = 0;
+	for (long i = 0; i < lookups; i++) hits_tree += find_node(root, docs[i]) != NULL;
+	double by_tree = now_seconds() - t0;
+
+	t0 = now_seconds();
+	freeze_index(root);
+	double freeze = now_seconds() - t0;
+
+	t0 = now_seconds();
+	long hits_one = 0;
+	for (long i = 0; i < lookups; i++) hits_one += frozen_find(docs[i]) != NULL;
+	double by_one = now_seconds() - t0;
+
+	t0 = now_seconds();
+	long hits_batch = frozen_find_batch(docs, (int)lookups, out);
+	double by_batch = now_seconds() - t0;
+
+	printf("\nAbordaje: %ld verificaciones sobre %d pasajeros (%ld encontrados)%s\n", lookups, count_nodes(root),
+		   hits_tree, hits_tree == hits_one && hits_tree == hits_batch ? "" : " INCONSISTENTE");
+	printf("Congelar: %.1f ms (%d niveles, %zu KB)\n", freeze * 1e3, congelado.levels,
+		   (size_t)congelado.cap * (sizeof(int) + sizeof(Node *)) / 1024);
+	printf("%-26s %10s\n", "búsqueda", "ns/doc");
+	printf("%-26s %10.1f\n", "árbol (find_node)", by_tree * 1e9 / lookups);
+	printf("%-26s %10.1f\n", "congelado, uno por uno", by_one * 1e9 / lookups);
+	printf("%-26s %10.1f\n", "congelado, en lotes", by_batch * 1e9 / lookups);
+	free(out);
+	free(docs);
+	free_tree(root);
+}
+
+//Carga de un archivo de agencia: rows filas con documentos distintos en
+//desorden, importadas de un buffer contra insert_node fila por fila
+void bench_import(long rows) {
+	int *docs = (int *)malloc(rows * sizeof(int));
+	char *buf = (char *)malloc(rows * 24 + 32);
+	if (!docs || !buf) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	for (long i = 0; i < rows; i++) docs[i] = (int)i + 1;
+	for (long i = rows - 1; i > 0; i--) { /* Fisher-Yates */
+		long j = (long)(bench_rand() % (i + 1));
+		int t = docs[i];
+		docs[i] = docs[j];
+		docs[j] = t;
+	}
+	long len = sprintf(buf, "documento,destino,tipo\n");
+	for (long i = 0; i < rows; i++)
+		len += sprintf(buf + len, "%d,%d,%d\n", docs[i], 1 + docs[i] % DEST_COUNT, 1 + docs[i] % 2);
+
+	printf("\nCarga masiva: %ld filas (%.1f MB)\n", rows, len / 1048576.0);
+	Node *root = NULL;
+	double t0 = now_seconds();
+	for (long i = 0; i < rows; i++) insert_node(&root, pasajero_n(docs[i]));
+	double by_insert = now_seconds() - t0;
+	int h_insert = tree_height(root);
+	free_tree(root);
+
+	root = NULL;
+	t0 = now_seconds();
+	import_buffer(&root, buf, len);
+	double by_import = now_seconds() - t0;
+
+	FILE *f = tmpfile();
+	t0 = now_seconds();
+	if (f) export_stream(root, f);
+	double by_export = now_seconds() - t0;
+	long out_len = f ? ftell(f) : 0;
+	if (f) fclose(f);
+
+	printf("%-26s %10s %8s\n", "carga", "ns/fila", "altura");
+	printf("%-26s %10.1f %8d\n", "insert_node por fila", by_insert * 1e9 / rows, h_insert);
+	printf("%-26s %10.1f %8d\n", "importar CSV (balanceado)", by_import * 1e9 / rows, tree_height(root));
+	printf("%-26s %10.1f %8s (%.1f MB)\n", "exportar inorden", by_export * 1e9 / rows, "-", out_len / 1048576.0);
+	free_tree(root);
+	free(buf);
+	free(docs);
+
+	/* última fila sin salto de línea, seguida de un dígito que no es del archivo */
+	const char tail[] = "5,1,1\n7,2,29";
+	root = NULL;
+	import_buffer(&root, tail, (long)sizeof(tail) - 2);
+	Node *last = find_node(root, 7);
+	printf("Última fila sin salto de línea: %s\n",
+		   count_nodes(root) == 2 && last && last->info.tipo_pasaje == 2 ? "ok" : "INCONSISTENTE");
+	free_tree(root);
+}
+
+int main(int argc, char **argv) {
+	long total = argc > 1 ? atol(argv[1]) : 10000000L;
+	if (total <= 0) {
+		fprintf(stderr, "Uso: %s [pasajeros]\n", argv[0]);
+		return 1;
+	}
+
+	printf("Inserción de documentos secuenciales (rojo-negro)\n");
+	printf("%-20s %10s %8s\n", "tramo", "ns/insert", "altura");
+	Node *root = NULL;
+	long done = 0;
+	for (long step = 1000; done < total; step *= 10) {
+		long upto = step < total ? step : total;
+		double t0 = now_seconds();
+		for (long d = done + 1; d <= upto; d++) insert_node(&root, pasajero_n((int)d));
+		double elapsed = now_seconds() - t0;
+		printf("%9ld-%-10ld %10.1f %8d\n", done + 1, upto, elapsed * 1e9 / (upto - done), tree_height(root));
+		done = upto;
+	}
+	print_pool_stats();
+	bench_destino(root, 2);
+	free_tree(root);
+
+	printf("\nReferencia: ABB sin balancear\n");
+	printf("%-20s %10s %8s\n", "tramo", "ns/insert", "altura");
+	PlainNode *plain = NULL;
+	long plain_total = total < 20000 ? total : 20000;
+	done = 0;
+	for (long upto = 5000; done < plain_total; upto += 5000) {
+		if (upto > plain_total) upto = plain_total;
+		double t0 = now_seconds();
+		for (long d = done + 1; d <= upto; d++) plain_insert(&plain, pasajero_n((int)d));
+		double elapsed = now_seconds() - t0;
+		printf("%9ld-%-10ld %10.1f %8ld\n", done + 1, upto, elapsed * 1e9 / (upto - done), upto);
+		done = upto;
+	}
+	plain_free(plain);
+
+	memset(&node_pool, 0, sizeof(node_pool));
+	bench_churn(total < 1000000 ? total : 1000000, 4000000);
+	bench_lookup(total < 4000000 ? total : 4000000, 10000000);
+	bench_import(total < 1000000 ? total : 1000000);
+	return 0;
+}
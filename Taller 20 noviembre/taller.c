@@ -2,146 +2,908 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 
 #define DEST_COUNT 4
-#define DEST_MAX_LEN 32
+#define TIPO_COUNT 2
 
 const char *destinos[DEST_COUNT] = {"Timbiquí", "Juanchaco", "Tumaco", "Guapi"};
 
 
+//Registro compacto: el destino es su posición en destinos[] y va junto al
+//tipo de pasaje, 8 bytes en total
 typedef struct Pasajero {
-	int documento;               
-	char destino[DEST_MAX_LEN];  
-	int tipo_pasaje;             
+	int documento;
+	unsigned char destino;      /* índice en destinos[] */
+	unsigned char tipo_pasaje;  /* 1 = Ida, 2 = Ida y Regreso */
 } Pasajero;
 
-//Nodo del ABB
+#define ROJO 0
+#define NEGRO 1
+
+//Nodo del ABB (árbol rojo-negro: la altura queda en O(log n) aunque los
+//documentos lleguen en orden)
 typedef struct Node {
 	Pasajero info;
 	struct Node *left;
 	struct Node *right;
+	struct Node *parent;
+	unsigned color : 1;
+	unsigned size : 31; /* pasajeros en este subárbol (él incluido) */
+	int pos;            /* posición en su índice secundario */
 } Node;
 
 
+//Memoria: los nodos se toman de bloques (slabs) de SLAB_NODES nodos
+//contiguos. Los que libera delete_node quedan en una lista libre y se
+//reutilizan antes de pedir otro bloque al heap; al salir se liberan los
+//bloques enteros, sin recorrer el árbol.
+#define SLAB_NODES 1024
+
+typedef struct Slab {
+	struct Slab *next;
+	Node nodes[SLAB_NODES];
+} Slab;
+
+typedef struct NodePool {
+	Slab *slabs;
+	int used;          /* nodos ya entregados del bloque más reciente */
+	Node *free_list;   /* nodos liberados, enlazados por el campo left */
+	long allocs;       /* nodos pedidos */
+	long reuses;       /* ...de ellos, servidos desde la lista libre */
+	long frees;        /* nodos devueltos */
+	long slab_count;   /* bloques pedidos al heap */
+} NodePool;
+
+NodePool node_pool;
+
+Node *pool_alloc_node(void) {
+	node_pool.allocs++;
+	if (node_pool.free_list) {
+		Node *n = node_pool.free_list;
+		node_pool.free_list = n->left;
+		node_pool.reuses++;
+		return n;
+	}
+	if (!node_pool.slabs || node_pool.used == SLAB_NODES) {
+		Slab *slab = (Slab *)malloc(sizeof(Slab));
+		if (!slab) {
+			node_pool.allocs--;
+			return NULL;
+		}
+		slab->next = node_pool.slabs;
+		node_pool.slabs = slab;
+		node_pool.used = 0;
+		node_pool.slab_count++;
+	}
+	return &node_pool.slabs->nodes[node_pool.used++];
+}
+
+void pool_free_node(Node *n) {
+	n->left = node_pool.free_list;
+	node_pool.free_list = n;
+	node_pool.frees++;
+}
+
+//Devolver todos los bloques al heap: O(número de bloques)
+void pool_destroy(void) {
+	while (node_pool.slabs) {
+		Slab *slab = node_pool.slabs;
+		node_pool.slabs = slab->next;
+		free(slab);
+	}
+	node_pool.used = 0;
+	node_pool.free_list = NULL;
+	node_pool.slab_count = 0;
+}
+
+//Uso del pool: nodos vivos, tasa de reutilización y memoria residente
+void print_pool_stats(void) {
+	printf("Nodos en uso: %ld | Reutilizados: %ld de %ld (%.1f%%)\n",
+		   node_pool.allocs - node_pool.frees, node_pool.reuses, node_pool.allocs,
+		   node_pool.allocs ? 100.0 * node_pool.reuses / node_pool.allocs : 0.0);
+	printf("Bloques: %ld de %d nodos | Memoria residente: %ld KB (%zu bytes por nodo)\n",
+		   node_pool.slab_count, SLAB_NODES, node_pool.slab_count * (long)sizeof(Slab) / 1024, sizeof(Node));
+}
+
 //Crear un nuevo nodo a partir de un Pasajero
 Node *create_node(Pasajero p) {
-	Node *n = (Node *)malloc(sizeof(Node));
+	Node *n = pool_alloc_node();
 	if (!n) {
 		perror("malloc");
 		exit(EXIT_FAILURE);
 	}
 	n->info = p;
-	n->left = n->right = NULL;
+	n->left = n->right = n->parent = NULL;
+	n->color = ROJO; /* todo nodo nuevo entra rojo */
+	n->size = 1;
 	return n;
 }
+
+int is_red(Node *n) {
+	return n && n->color == ROJO;
+}
+
+int node_size(Node *n) {
+	return n ? (int)n->size : 0;
+}
+
+//Índices secundarios: un arreglo de nodos por cada par (destino, tipo de
+//pasaje). Listar un destino o un tipo recorre solo sus k pasajeros y
+//contarlos es O(1); cada nodo guarda su posición para salir en O(1).
+typedef struct Indice {
+	Node **nodos;
+	int count;
+	int cap;
+} Indice;
+
+Indice indices[DEST_COUNT][TIPO_COUNT];
+
+void index_add(Node *n) {
+	Indice *ix = &indices[n->info.destino][n->info.tipo_pasaje - 1];
+	if (ix->count == ix->cap) {
+		int cap = ix->cap ? ix->cap * 2 : 64;
+		Node **nodos = (Node **)realloc(ix->nodos, cap * sizeof(Node *));
+		if (!nodos) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+		ix->nodos = nodos;
+		ix->cap = cap;
+	}
+	n->pos = ix->count;
+	ix->nodos[ix->count++] = n;
+}
+
+//Quitar n: el último del arreglo ocupa su lugar
+void index_remove(Node *n) {
+	Indice *ix = &indices[n->info.destino][n->info.tipo_pasaje - 1];
+	Node *last = ix->nodos[--ix->count];
+	ix->nodos[n->pos] = last;
+	last->pos = n->pos;
+}
+
+void index_free(void) {
+	for (int d = 0; d < DEST_COUNT; d++) {
+		for (int t = 0; t < TIPO_COUNT; t++) {
+			free(indices[d][t].nodos);
+			indices[d][t].nodos = NULL;
+			indices[d][t].count = indices[d][t].cap = 0;
+		}
+	}
+}
+
+int count_destino(int destino) {
+	int c = 0;
+	for (int t = 0; t < TIPO_COUNT; t++) c += indices[destino][t].count;
+	return c;
+}
+
+int count_tipo(int tipo_pasaje) {
+	int c = 0;
+	for (int d = 0; d < DEST_COUNT; d++) c += indices[d][tipo_pasaje - 1].count;
+	return c;
+}
+
+//Índice congelado para el abordaje: los documentos en un arreglo en orden de
+//Eytzinger (hijos de k en 2k y 2k+1). Es una foto del árbol: cualquier
+//registro o eliminación lo descarta y las búsquedas vuelven al árbol.
+typedef struct Congelado {
+	int *keys;     /* keys[1..cap-1]; los huecos después del último van en INT_MAX */
+	Node **nodes;  /* nodo de cada posición (NULL en los huecos) */
+	int n;         /* pasajeros congelados (0 = sin índice) */
+	int levels;    /* niveles del árbol implícito: cap = 2^levels */
+	int cap;
+} Congelado;
+
+Congelado congelado;
+
+void thaw_index(void) {
+	free(congelado.keys);
+	free(congelado.nodes);
+	memset(&congelado, 0, sizeof(congelado));
+}
+
+//Rotaciones: conservan el orden del ABB y actualizan los padres
+
+void rotate_left(Node **root, Node *x) {
+	Node *y = x->right;
+	x->right = y->left;
+	if (y->left) y->left->parent = x;
+	y->parent = x->parent;
+	if (!x->parent) *root = y;
+	else if (x == x->parent->left) x->parent->left = y;
+	else x->parent->right = y;
+	y->left = x;
+	x->parent = y;
+	y->size = x->size;
+	x->size = 1 + node_size(x->left) + node_size(x->right);
+}
+
+void rotate_right(Node **root, Node *x) {
+	Node *y = x->left;
+	x->left = y->right;
+	if (y->right) y->right->parent = x;
+	y->parent = x->parent;
+	if (!x->parent) *root = y;
+	else if (x == x->parent->right) x->parent->right = y;
+	else x->parent->left = y;
+	y->right = x;
+	x->parent = y;
+	y->size = x->size;
+	x->size = 1 + node_size(x->left) + node_size(x->right);
+}
+
+//Buscar un pasajero por documento (NULL si no existe)
+Node *find_node(Node *root, int documento) {
+	while (root && root->info.documento != documento)
+		root = documento < root->info.documento ? root->left : root->right;
+	return root;
+}
+
+Node *find_min(Node *root) {
+	if (!root) return NULL;
+	while (root->left) root = root->left;
+	return root;
+}
+
+//Después de insertar z (rojo): recolorear o rotar hasta que ningún nodo
+//rojo tenga un hijo rojo
+void insert_fixup(Node **root, Node *z) {
+	while (is_red(z->parent)) {
+		Node *g = z->parent->parent; /* existe: la raíz siempre es negra */
+		if (z->parent == g->left) {
+			Node *u = g->right;
+			if (is_red(u)) {
+				z->parent->color = NEGRO;
+				u->color = NEGRO;
+				g->color = ROJO;
+				z = g;
+			} else {
+				if (z == z->parent->right) {
+					z = z->parent;
+					rotate_left(root, z);
+				}
+				z->parent->color = NEGRO;
+				g->color = ROJO;
+				rotate_right(root, g);
+			}
+		} else {
+			Node *u = g->left;
+			if (is_red(u)) {
+				z->parent->color = NEGRO;
+				u->color = NEGRO;
+				g->color = ROJO;
+				z = g;
+			} else {
+				if (z == z->parent->left) {
+					z = z->parent;
+					rotate_right(root, z);
+				}
+				z->parent->color = NEGRO;
+				g->color = ROJO;
+				rotate_left(root, g);
+			}
+		}
+	}
+	(*root)->color = NEGRO;
+}
+
 //Insertar un nodo en el ABB
 
 int insert_node(Node **root, Pasajero p) {
-	if (*root == NULL) {
-		*root = create_node(p);
-		return 1; /* insertado */
-	}
-	if (p.documento < (*root)->info.documento) {
-		return insert_node(&(*root)->left, p);
-	} else if (p.documento > (*root)->info.documento) {
-		return insert_node(&(*root)->right, p);
-	} else {
-		/* documento repetido */
-		return 0; /* no insertado */
+	Node *parent = NULL;
+	Node **link = root;
+	while (*link) {
+		parent = *link;
+		if (p.documento < parent->info.documento) {
+			link = &parent->left;
+		} else if (p.documento > parent->info.documento) {
+			link = &parent->right;
+		} else {
+			/* documento repetido */
+			return 0; /* no insertado */
+		}
 	}
+	Node *n = create_node(p);
+	n->parent = parent;
+	*link = n;
+	for (Node *a = parent; a; a = a->parent) a->size++;
+	insert_fixup(root, n);
+	index_add(n);
+	if (congelado.n) thaw_index();
+	return 1; /* insertado */
 }
 //Mostrar pasajero (formato legible)
 
 void print_pasajero(const Pasajero *p) {
 	printf("Documento: %d | Destino: %s | Tipo: %s\n",
 		   p->documento,
-		   p->destino,
+		   destinos[p->destino],
 		   (p->tipo_pasaje == 1) ? "Ida" : "Ida y Regreso");
 }
 
+//Listados por índice secundario (en el orden de su arreglo, no por documento)
+
+void list_destino(int destino) {
+	for (int t = 0; t < TIPO_COUNT; t++) {
+		Indice *ix = &indices[destino][t];
+		for (int i = 0; i < ix->count; i++) print_pasajero(&ix->nodos[i]->info);
+	}
+}
+
+void list_tipo(int tipo_pasaje) {
+	for (int d = 0; d < DEST_COUNT; d++) {
+		Indice *ix = &indices[d][tipo_pasaje - 1];
+		for (int i = 0; i < ix->count; i++) print_pasajero(&ix->nodos[i]->info);
+	}
+}
+
 
     //Recorridos (inorden, preorden, postorden)
+//Sin recursión ni pila: cada paso sube o baja por los punteros al padre,
+//así la profundidad del árbol nunca depende de la pila de llamadas
+
+Node *next_inorder(Node *n) {
+	if (n->right) return find_min(n->right);
+	while (n->parent && n == n->parent->right) n = n->parent;
+	return n->parent;
+}
+
+Node *next_preorder(Node *n) {
+	if (n->left) return n->left;
+	if (n->right) return n->right;
+	for (; n->parent; n = n->parent)
+		if (n == n->parent->left && n->parent->right) return n->parent->right;
+	return NULL;
+}
+
+//Primer nodo en postorden del subárbol: la hoja a la que se llega bajando
+//por la izquierda siempre que se pueda
+Node *first_postorder(Node *n) {
+	while (n && (n->left || n->right)) n = n->left ? n->left : n->right;
+	return n;
+}
+
+Node *next_postorder(Node *n) {
+	Node *p = n->parent;
+	if (p && n == p->left && p->right) return first_postorder(p->right);
+	return p;
+}
 
 void inorder(Node *root) {
-	if (!root) return;
-	inorder(root->left);
-	print_pasajero(&root->info);
-	inorder(root->right);
+	for (Node *n = find_min(root); n; n = next_inorder(n))
+		print_pasajero(&n->info);
 }
 
 void preorder(Node *root) {
-	if (!root) return;
-	print_pasajero(&root->info);
-	preorder(root->left);
-	preorder(root->right);
+	for (Node *n = root; n; n = next_preorder(n))
+		print_pasajero(&n->info);
 }
 
 void postorder(Node *root) {
-	if (!root) return;
-	postorder(root->left);
-	postorder(root->right);
-	print_pasajero(&root->info);
+	for (Node *n = first_postorder(root); n; n = next_postorder(n))
+		print_pasajero(&n->info);
 }
 
-//Conteo de nodos
+//Conteo de nodos: cada nodo guarda el tamaño de su subárbol, O(1)
 
 int count_nodes(Node *root) {
-	if (!root) return 0;
-	return 1 + count_nodes(root->left) + count_nodes(root->right);
+	return node_size(root);
+}
+
+//Cuántos pasajeros tienen un documento menor (O(log n))
+int rank_documento(Node *root, int documento) {
+	int r = 0;
+	while (root) {
+		if (documento <= root->info.documento) {
+			root = root->left;
+		} else {
+			r += node_size(root->left) + 1;
+			root = root->right;
+		}
+	}
+	return r;
+}
+
+//Pasajero en la posición k del orden por documento (0 = el menor), O(log n);
+//NULL si k está fuera de rango
+Node *select_node(Node *root, int k) {
+	while (root) {
+		int l = node_size(root->left);
+		if (k < l) {
+			root = root->left;
+		} else if (k == l) {
+			return root;
+		} else {
+			k -= l + 1;
+			root = root->right;
+		}
+	}
+	return NULL;
 }
 
 
 //Eliminación de un nodo por documento
 
-Node *find_min(Node *root) {
-	if (!root) return NULL;
-	while (root->left) root = root->left;
-	return root;
+//Poner el subárbol v en el lugar de u
+void transplant(Node **root, Node *u, Node *v) {
+	if (!u->parent) *root = v;
+	else if (u == u->parent->left) u->parent->left = v;
+	else u->parent->right = v;
+	if (v) v->parent = u->parent;
+}
+
+//Se quitó un nodo negro: x (puede ser NULL, hijo de parent) lleva un negro
+//de más que se empuja hacia arriba o se resuelve con rotaciones
+void delete_fixup(Node **root, Node *x, Node *parent) {
+	while (x != *root && !is_red(x)) {
+		if (x == parent->left) {
+			Node *w = parent->right;
+			if (is_red(w)) {
+				w->color = NEGRO;
+				parent->color = ROJO;
+				rotate_left(root, parent);
+				w = parent->right;
+			}
+			if (!is_red(w->left) && !is_red(w->right)) {
+				w->color = ROJO;
+				x = parent;
+				parent = x->parent;
+			} else {
+				if (!is_red(w->right)) {
+					w->left->color = NEGRO;
+					w->color = ROJO;
+					rotate_right(root, w);
+					w = parent->right;
+				}
+				w->color = parent->color;
+				parent->color = NEGRO;
+				w->right->color = NEGRO;
+				rotate_left(root, parent);
+				x = *root;
+			}
+		} else {
+			Node *w = parent->left;
+			if (is_red(w)) {
+				w->color = NEGRO;
+				parent->color = ROJO;
+				rotate_right(root, parent);
+				w = parent->left;
+			}
+			if (!is_red(w->left) && !is_red(w->right)) {
+				w->color = ROJO;
+				x = parent;
+				parent = x->parent;
+			} else {
+				if (!is_red(w->left)) {
+					w->right->color = NEGRO;
+					w->color = ROJO;
+					rotate_left(root, w);
+					w = parent->left;
+				}
+				w->color = parent->color;
+				parent->color = NEGRO;
+				w->left->color = NEGRO;
+				rotate_right(root, parent);
+				x = *root;
+			}
+		}
+	}
+	if (x) x->color = NEGRO;
 }
 
 Node *delete_node(Node *root, int documento, int *deleted) {
-	if (!root) return NULL;
-	if (documento < root->info.documento) {
-		root->left = delete_node(root->left, documento, deleted);
-	} else if (documento > root->info.documento) {
-		root->right = delete_node(root->right, documento, deleted);
+	Node *z = find_node(root, documento);
+	if (!z) return root;
+	/* encontrado */
+	*deleted = 1;
+	Node *x, *x_parent;
+	int removed_color = z->color;
+	if (!z->left) {
+		x = z->right;
+		x_parent = z->parent;
+		transplant(&root, z, z->right);
+	} else if (!z->right) {
+		x = z->left;
+		x_parent = z->parent;
+		transplant(&root, z, z->left);
 	} else {
-		/* encontrado */
-		*deleted = 1;
-		if (!root->left && !root->right) {
-			free(root);
-			return NULL;
-		} else if (!root->left) {
-			Node *tmp = root->right;
-			free(root);
-			return tmp;
-		} else if (!root->right) {
-			Node *tmp = root->left;
-			free(root);
-			return tmp;
+		/* dos hijos: el sucesor se mueve al lugar del nodo (no se copian datos) */
+		Node *y = find_min(z->right);
+		removed_color = y->color;
+		x = y->right;
+		if (y->parent == z) {
+			x_parent = y;
 		} else {
-			Node *minRight = find_min(root->right);
-			root->info = minRight->info; /* copiar datos del sucesor */
-			root->right = delete_node(root->right, minRight->info.documento, deleted);
+			x_parent = y->parent;
+			transplant(&root, y, y->right);
+			y->right = z->right;
+			y->right->parent = y;
 		}
+		transplant(&root, z, y);
+		y->left = z->left;
+		y->left->parent = y;
+		y->color = z->color;
 	}
+	/* el camino desde donde se quitó el nodo hasta la raíz pierde un pasajero */
+	for (Node *a = x_parent; a; a = a->parent)
+		a->size = 1 + node_size(a->left) + node_size(a->right);
+	index_remove(z);
+	pool_free_node(z);
+	if (removed_color == NEGRO) delete_fixup(&root, x, x_parent);
+	if (congelado.n) thaw_index();
 	return root;
 }
 
 
-//Liberar memoria del árbol
+//Congelar: recorrer el árbol en inorden y repartir los documentos sobre el
+//árbol implícito completo de cap-1 posiciones, también en inorden. Sobra
+//espacio hasta la siguiente potencia de 2 para que toda búsqueda baje el
+//mismo número de niveles.
+
+void freeze_index(Node *root) {
+	thaw_index();
+	int n = count_nodes(root);
+	if (!n) return;
+	int levels = 0;
+	while ((1L << levels) <= n) levels++;
+	int cap = 1 << levels;
+	congelado.keys = (int *)malloc(cap * sizeof(int));
+	congelado.nodes = (Node **)malloc(cap * sizeof(Node *));
+	if (!congelado.keys || !congelado.nodes) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	congelado.keys[0] = INT_MIN;
+	congelado.nodes[0] = NULL;
+	/* k recorre el árbol implícito en inorden sin pila: primero el extremo
+	   izquierdo, luego el mínimo del hijo derecho o subir mientras k sea hijo derecho */
+	int k = 1;
+	while (2 * k < cap) k *= 2;
+	Node *t = find_min(root);
+	for (int i = 1; i < cap; i++) {
+		congelado.keys[k] = t ? t->info.documento : INT_MAX;
+		congelado.nodes[k] = t;
+		if (t) t = next_inorder(t);
+		if (2 * k + 1 < cap) {
+			k = 2 * k + 1;
+			while (2 * k < cap) k *= 2;
+		} else {
+			while (k & 1) k >>= 1;
+			k >>= 1;
+		}
+	}
+	congelado.n = n;
+	congelado.levels = levels;
+	congelado.cap = cap;
+}
+
+//Búsqueda sin saltos: en cada nivel la comparación se suma al índice en vez
+//de decidir un if; al final se deshacen los pasos a la derecha del último
+//tramo y queda la primera posición con documento >= buscado. El prefetch
+//pide la línea de los 16 descendientes cuatro niveles más abajo.
+Node *frozen_find(int documento) {
+	const int *keys = congelado.keys;
+	unsigned k = 1;
+	for (int l = 0; l < congelado.levels; l++) {
+		__builtin_prefetch(keys + (16 * k < (unsigned)congelado.cap ? 16 * k : 0));
+		k = 2 * k + (keys[k] < documento);
+	}
+	k >>= __builtin_ffs(~k);
+	return keys[k] == documento ? congelado.nodes[k] : NULL;
+}
+
+//Lote de búsquedas: FROZEN_GROUP documentos bajan juntos nivel por nivel,
+//así sus accesos a memoria se solapan en lugar de esperarse uno a otro. El
+//ciclo interno no tiene saltos y el compilador lo puede vectorizar.
+#define FROZEN_GROUP 16
+
+int frozen_find_batch(const int *docs, int count, Node **out) {
+	const int *keys = congelado.keys;
+	int found = 0;
+	for (int base = 0; base < count; base += FROZEN_GROUP) {
+		int g = count - base < FROZEN_GROUP ? count - base : FROZEN_GROUP;
+		const int *d = docs + base;
+		unsigned k[FROZEN_GROUP];
+		for (int j = 0; j < g; j++) k[j] = 1;
+		for (int l = 0; l < congelado.levels; l++) {
+			for (int j = 0; j < g; j++) k[j] = 2 * k[j] + (keys[k[j]] < d[j]);
+			for (int j = 0; j < g; j++) __builtin_prefetch(keys + (16 * k[j] < (unsigned)congelado.cap ? 16 * k[j] : 0));
+		}
+		for (int j = 0; j < g; j++) {
+			unsigned kj = k[j] >> __builtin_ffs(~k[j]);
+			out[base + j] = keys[kj] == d[j] ? congelado.nodes[kj] : NULL;
+			found += out[base + j] != NULL;
+		}
+	}
+	return found;
+}
+
+//Buscar por documento: con el índice congelado si existe, si no en el árbol
+Node *lookup_pasajero(Node *root, int documento) {
+	return congelado.n ? frozen_find(documento) : find_node(root, documento);
+}
+
+
+//Carga masiva: archivo CSV "documento,destino,tipo" (destino por número 1..4
+//o por nombre, tipo 1 = Ida, 2 = Ida y Regreso; una primera línea de
+//encabezado se ignora). El archivo se lee entero a un buffer, las filas se
+//ordenan por documento y el árbol se arma de nuevo balanceado en O(n).
+
+typedef struct FilaCsv {
+	Pasajero p;
+	int linea;
+} FilaCsv;
+
+int compare_filas(const void *a, const void *b) {
+	const FilaCsv *x = (const FilaCsv *)a, *y = (const FilaCsv *)b;
+	if (x->p.documento != y->p.documento) return x->p.documento < y->p.documento ? -1 : 1;
+	return x->linea - y->linea; /* entre repetidos gana el primero del archivo */
+}
+
+//Enlazar nodos[lo..hi) (ordenados) con la mitad como raíz. Todos negros salvo
+//el nivel red_depth (el último, si está incompleto), que va rojo: así toda
+//ruta a un NULL tiene los mismos negros. La recursión baja log2 n niveles.
+Node *build_balanced(Node **nodos, int lo, int hi, Node *parent, int depth, int red_depth) {
+	if (lo >= hi) return NULL;
+	int mid = lo + (hi - lo) / 2;
+	Node *n = nodos[mid];
+	n->parent = parent;
+	n->color = depth == red_depth ? ROJO : NEGRO;
+	n->size = hi - lo;
+	n->left = build_balanced(nodos, lo, mid, n, depth + 1, red_depth);
+	n->right = build_balanced(nodos, mid + 1, hi, n, depth + 1, red_depth);
+	return n;
+}
+
+Node *build_tree(Node **nodos, int n) {
+	int levels = 0;
+	while ((1L << levels) <= n) levels++;
+	int red_depth = ((n + 1) & n) ? levels - 1 : -1; /* n+1 potencia de 2: árbol perfecto */
+	Node *root = build_balanced(nodos, 0, n, NULL, 0, red_depth);
+	if (root) root->color = NEGRO;
+	return root;
+}
+
+//Leer un campo de destino (número o nombre) entre c y end; 0 si no es válido
+int parse_destino(const char *c, const char *end) {
+	while (c < end && *c == ' ') c++;
+	while (end > c && end[-1] == ' ') end--;
+	if (end - c == 1 && *c >= '1' && *c < '1' + DEST_COUNT) return *c - '0';
+	for (int d = 0; d < DEST_COUNT; d++)
+		if ((size_t)(end - c) == strlen(destinos[d]) && !memcmp(c, destinos[d], end - c)) return d + 1;
+	return 0;
+}
+
+//Leer un entero entre c y end (espacios alrededor y signo opcionales); 0 si el
+//campo no es un entero válido. Nunca lee fuera de [c, end).
+int parse_entero(const char *c, const char *end, long *out) {
+	while (c < end && *c == ' ') c++;
+	while (end > c && end[-1] == ' ') end--;
+	int neg = c < end && *c == '-';
+	if (neg || (c < end && *c == '+')) c++;
+	if (c == end) return 0;
+	long v = 0;
+	for (; c < end; c++) {
+		if (*c < '0' || *c > '9') return 0;
+		v = v * 10 + (*c - '0');
+		if (v > (long)INT_MAX + 1) return 0;
+	}
+	*out = neg ? -v : v;
+	return *out >= INT_MIN && *out <= INT_MAX;
+}
+
+//Importar desde buf (len bytes, sin terminador). Las filas inválidas o con documento repetido
+//se informan y se ignoran, como en el registro manual. Devuelve cuántos
+//pasajeros se agregaron.
+int import_buffer(Node **root, const char *buf, long len) {
+	const char *c = buf, *stop = buf + len;
+	int cap = 1024, count = 0, linea = 0, invalid = 0, repeated = 0;
+	FilaCsv *filas = (FilaCsv *)malloc(cap * sizeof(FilaCsv));
+	if (!filas) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	while (c < stop) {
+		const char *eol = memchr(c, '\n', stop - c);
+		if (!eol) eol = stop;
+		const char *end = eol;
+		if (end > c && end[-1] == '\r') end--;
+		linea++;
+		if (end == c) {
+			c = eol + 1;
+			continue;
+		}
+		if (linea == 1 && !(*c == '-' || (*c >= '0' && *c <= '9'))) {
+			c = eol + 1; /* encabezado */
+			continue;
+		}
+		/* documento */
+		long doc = 0, tipo = 0;
+		const char *f2 = memchr(c, ',', end - c);
+		if (f2 && !parse_entero(c, f2, &doc)) f2 = NULL;
+		if (f2) f2++;
+		const char *f3 = f2 ? memchr(f2, ',', end - f2) : NULL;
+		int destino = f3 ? parse_destino(f2, f3) : 0;
+		if (destino && !parse_entero(f3 + 1, end, &tipo)) tipo = 0;
+		if (!f2) {
+			printf("Línea %d: documento inválido. Registro ignorado.\n", linea);
+			invalid++;
+		} else if (!destino) {
+			printf("Línea %d: destino inválido. Registro ignorado.\n", linea);
+			invalid++;
+		} else if (tipo != 1 && tipo != 2) {
+			printf("Línea %d: tipo inválido. Registro ignorado.\n", linea);
+			invalid++;
+		} else {
+			if (count == cap) {
+				cap *= 2;
+				FilaCsv *grown = (FilaCsv *)realloc(filas, cap * sizeof(FilaCsv));
+				if (!grown) {
+					perror("realloc");
+					exit(EXIT_FAILURE);
+				}
+				filas = grown;
+			}
+			filas[count].p.documento = (int)doc;
+			filas[count].p.destino = (unsigned char)(destino - 1);
+			filas[count].p.tipo_pasaje = (unsigned char)tipo;
+			filas[count].linea = linea;
+			count++;
+		}
+		c = eol + 1;
+	}
+	qsort(filas, count, sizeof(FilaCsv), compare_filas);
+
+	/* mezclar con los pasajeros que ya estaban (en inorden) */
+	int existing = count_nodes(*root);
+	Node **nodos = (Node **)malloc(((long)existing + count + 1) * sizeof(Node *));
+	if (!nodos) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	int total = 0, added = 0;
+	Node *t = find_min(*root);
+	for (int i = 0; i < count; i++) {
+		while (t && t->info.documento < filas[i].p.documento) {
+			nodos[total++] = t;
+			t = next_inorder(t);
+		}
+		if ((t && t->info.documento == filas[i].p.documento) ||
+			(total && nodos[total - 1]->info.documento == filas[i].p.documento)) {
+			printf("Línea %d: documento %d ya existe. Registro ignorado.\n", filas[i].linea, filas[i].p.documento);
+			repeated++;
+			continue;
+		}
+		Node *n = create_node(filas[i].p);
+		index_add(n);
+		nodos[total++] = n;
+		added++;
+	}
+	for (; t; t = next_inorder(t)) nodos[total++] = t;
+	*root = build_tree(nodos, total);
+	if (congelado.n) thaw_index();
+	printf("Importados: %d | Repetidos: %d | Inválidos: %d | Total: %d\n", added, repeated, invalid, total);
+	free(nodos);
+	free(filas);
+	return added;
+}
+
+//Leer el archivo completo e importarlo; -1 si no se puede leer
+int import_csv(Node **root, const char *path) {
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	long cap = 1 << 16, len = 0;
+	char *buf = (char *)malloc(cap);
+	size_t got;
+	while (buf && (got = fread(buf + len, 1, cap - len, f)) > 0) {
+		len += (long)got;
+		if (len == cap) {
+			cap *= 2;
+			char *grown = (char *)realloc(buf, cap);
+			if (!grown) free(buf);
+			buf = grown;
+		}
+	}
+	fclose(f);
+	if (!buf) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	buf[len] = '\0'; /* len < cap: el ciclo crece el buffer cuando se llena */
+	int added = import_buffer(root, buf, len);
+	free(buf);
+	return added;
+}
+
+//Escritura con buffer propio: cada fila se arma a mano y el buffer se vacía
+//con un solo fwrite cada 64 KB
+#define WRITER_SIZE (1 << 16)
+
+typedef struct Writer {
+	FILE *f;
+	int len;
+	char buf[WRITER_SIZE];
+} Writer;
+
+void writer_flush(Writer *w) {
+	fwrite(w->buf, 1, w->len, w->f);
+	w->len = 0;
+}
+
+void writer_put(Writer *w, const char *s, int n) {
+	if (w->len + n > WRITER_SIZE) writer_flush(w);
+	memcpy(w->buf + w->len, s, n);
+	w->len += n;
+}
+
+void writer_int(Writer *w, int v) {
+	char tmp[12];
+	int i = sizeof(tmp);
+	unsigned u = v < 0 ? 0u - (unsigned)v : (unsigned)v;
+	do {
+		tmp[--i] = (char)('0' + u % 10);
+		u /= 10;
+	} while (u);
+	if (v < 0) tmp[--i] = '-';
+	writer_put(w, tmp + i, sizeof(tmp) - i);
+}
+
+//Exportar en inorden con el mismo formato que lee import_csv
+void export_stream(Node *root, FILE *f) {
+	static Writer w;
+	w.f = f;
+	w.len = 0;
+	writer_put(&w, "documento,destino,tipo\n", 23);
+	for (Node *n = find_min(root); n; n = next_inorder(n)) {
+		writer_int(&w, n->info.documento);
+		writer_put(&w, ",", 1);
+		writer_put(&w, destinos[n->info.destino], (int)strlen(destinos[n->info.destino]));
+		writer_put(&w, n->info.tipo_pasaje == 1 ? ",1\n" : ",2\n", 3);
+	}
+	writer_flush(&w);
+}
+
+//Exportar a un archivo ("-" = salida estándar); -1 si no se puede escribir
+int export_csv(Node *root, const char *path) {
+	if (!strcmp(path, "-")) {
+		export_stream(root, stdout);
+		fflush(stdout);
+		return count_nodes(root);
+	}
+	FILE *f = fopen(path, "wb");
+	if (!f) {
+		perror(path);
+		return -1;
+	}
+	export_stream(root, f);
+	if (fclose(f) != 0) {
+		perror(path);
+		return -1;
+	}
+	return count_nodes(root);
+}
+
+
+//Liberar memoria del árbol: todos los nodos viven en el pool, así que se
+//devuelven sus bloques completos en vez de recorrer el árbol nodo por nodo
 
 void free_tree(Node *root) {
-	if (!root) return;
-	free_tree(root->left);
-	free_tree(root->right);
-	free(root);
+	(void)root;
+	pool_destroy();
+	index_free();
+	thaw_index();
 }
 
 
 //helpers de entrada (seleccionar destino y tipo)
 
-int seleccionar_destino(char *out_dest) {
+//Devuelve el destino elegido (1..DEST_COUNT) o 0 si la opción es inválida
+int seleccionar_destino(void) {
 	int opt = 0;
 	printf("Seleccione destino:\n");
 	for (int i = 0; i < DEST_COUNT; ++i) {
@@ -153,9 +915,7 @@ int seleccionar_destino(char *out_dest) {
 		return 0;
 	}
 	if (opt < 1 || opt > DEST_COUNT) return 0;
-	strncpy(out_dest, destinos[opt - 1], DEST_MAX_LEN - 1);
-	out_dest[DEST_MAX_LEN - 1] = '\0';
-	return 1;
+	return opt;
 }
 
 int seleccionar_tipo() {
@@ -170,20 +930,52 @@ int seleccionar_tipo() {
 }
 
 
+#ifndef TALLER_NO_MAIN
+//Modo por lotes: taller.exe --import ventas.csv --export salida.csv (en el
+//orden dado, sin menú); sin argumentos abre el menú interactivo
+int run_args(Node **root, int argc, char **argv) {
+	for (int i = 1; i < argc; i += 2) {
+		if (i + 1 >= argc || (strcmp(argv[i], "--import") && strcmp(argv[i], "--export"))) {
+			fprintf(stderr, "Uso: %s [--import archivo.csv] [--export archivo.csv|-]\n", argv[0]);
+			return 1;
+		}
+		int r = !strcmp(argv[i], "--import") ? import_csv(root, argv[i + 1]) : export_csv(*root, argv[i + 1]);
+		if (r < 0) return 1;
+	}
+	return 0;
+}
+
 //menú interactivo
-int main(void) {
+int main(int argc, char **argv) {
 	Node *root = NULL;
 	int running = 1;
 
+	if (argc > 1) {
+		int status = run_args(&root, argc, argv);
+		free_tree(root);
+		return status;
+	}
+
 	while (running) {
-		printf("\n Sistema de Tiquetes (ABB) \n");
+		printf("\n Sistema de Tiquetes (ABB rojo-negro) \n");
 		printf("1) Registrar pasajero\n");
 		printf("2) Eliminar pasajero por documento\n");
 		printf("3) Listar Inorden\n");
 		printf("4) Listar Preorden\n");
 		printf("5) Listar Postorden\n");
 		printf("6) Contar pasajeros\n");
-		printf("7) Salir\n");
+		printf("7) Posición de un pasajero por documento\n");
+		printf("8) Listar grupo de abordaje\n");
+		printf("9) Estadísticas de memoria\n");
+		printf("10) Listar pasajeros por destino\n");
+		printf("11) Listar pasajeros por tipo de pasaje\n");
+		printf("12) Conteo por destino y tipo de pasaje\n");
+		printf("13) Buscar pasajero por documento\n");
+		printf("14) Congelar índice para abordaje\n");
+		printf("15) Verificar lote de documentos\n");
+		printf("16) Importar pasajeros desde CSV\n");
+		printf("17) Exportar pasajeros a CSV\n");
+		printf("18) Salir\n");
 		printf("Seleccione opción: ");
 
 		int opt = 0;
@@ -205,12 +997,14 @@ int main(void) {
 				}
 				while (getchar() != '\n'); /* limpiar buffer */
 
-				if (!seleccionar_destino(p.destino)) {
+				int destino = seleccionar_destino();
+				if (!destino) {
 					printf("Destino inválido. Registro cancelado.\n");
 					break;
 				}
+				p.destino = (unsigned char)(destino - 1);
 
-				p.tipo_pasaje = seleccionar_tipo();
+				p.tipo_pasaje = (unsigned char)seleccionar_tipo();
 				if (p.tipo_pasaje == 0) {
 					printf("Tipo inválido. Registro cancelado.\n");
 					break;
@@ -251,7 +1045,155 @@ int main(void) {
 				printf("Total de pasajeros registrados: %d\n", c);
 				break;
 			}
-			case 7:
+			case 7: {
+				int doc;
+				printf("Documento: ");
+				if (scanf("%d", &doc) != 1) {
+					printf("Entrada inválida.\n");
+					while (getchar() != '\n');
+					break;
+				}
+				int r = rank_documento(root, doc);
+				if (find_node(root, doc))
+					printf("El documento %d ocupa la posición %d de %d.\n", doc, r + 1, count_nodes(root));
+				else
+					printf("Documento %d no encontrado; %d pasajeros tienen un documento menor.\n", doc, r);
+				break;
+			}
+			case 8: {
+				/* grupos consecutivos por documento: el grupo g empieza en la posición (g-1)*tamaño */
+				int size, group;
+				printf("Pasajeros por grupo: ");
+				if (scanf("%d", &size) != 1 || size <= 0) {
+					printf("Entrada inválida.\n");
+					while (getchar() != '\n');
+					break;
+				}
+				printf("Número de grupo: ");
+				if (scanf("%d", &group) != 1 || group <= 0) {
+					printf("Entrada inválida.\n");
+					while (getchar() != '\n');
+					break;
+				}
+				long first = (long)(group - 1) * size;
+				Node *n = first < count_nodes(root) ? select_node(root, (int)first) : NULL;
+				if (!n) {
+					printf("El grupo %d está vacío.\n", group);
+					break;
+				}
+				for (int i = 0; n && i < size; i++, n = next_inorder(n))
+					print_pasajero(&n->info);
+				break;
+			}
+			case 9:
+				print_pool_stats();
+				break;
+			case 10: {
+				int destino = seleccionar_destino();
+				if (!destino) {
+					printf("Destino inválido.\n");
+					break;
+				}
+				if (!count_destino(destino - 1)) printf("No hay pasajeros para %s.\n", destinos[destino - 1]);
+				else list_destino(destino - 1);
+				printf("Pasajeros con destino %s: %d\n", destinos[destino - 1], count_destino(destino - 1));
+				break;
+			}
+			case 11: {
+				int tipo = seleccionar_tipo();
+				if (!tipo) {
+					printf("Tipo inválido.\n");
+					break;
+				}
+				if (!count_tipo(tipo)) printf("No hay pasajeros con ese tipo de pasaje.\n");
+				else list_tipo(tipo);
+				printf("Pasajeros con tipo %s: %d\n", tipo == 1 ? "Ida" : "Ida y Regreso", count_tipo(tipo));
+				break;
+			}
+			case 12:
+				printf("%-12s %8s %14s %8s\n", "Destino", "Ida", "Ida y Regreso", "Total");
+				for (int d = 0; d < DEST_COUNT; d++)
+					printf("%-12s %8d %14d %8d\n", destinos[d], indices[d][0].count, indices[d][1].count, count_destino(d));
+				printf("%-12s %8d %14d %8d\n", "Total", count_tipo(1), count_tipo(2), count_nodes(root));
+				break;
+			case 13: {
+				int doc;
+				printf("Documento: ");
+				if (scanf("%d", &doc) != 1) {
+					printf("Entrada inválida.\n");
+					while (getchar() != '\n');
+					break;
+				}
+				Node *n = lookup_pasajero(root, doc);
+				if (n) print_pasajero(&n->info);
+				else printf("Documento %d no encontrado.\n", doc);
+				break;
+			}
+			case 14:
+				freeze_index(root);
+				if (!congelado.n) printf("Árbol vacío.\n");
+				else printf("Índice congelado: %d pasajeros en %d niveles. Registrar o eliminar lo descarta.\n",
+							congelado.n, congelado.levels);
+				break;
+			case 15: {
+				/* documentos en una línea, terminados en 0 */
+				int cap = 64, count = 0, doc;
+				int *docs = (int *)malloc(cap * sizeof(int));
+				if (!docs) {
+					perror("malloc");
+					exit(EXIT_FAILURE);
+				}
+				printf("Documentos (terminar con 0): ");
+				while (scanf("%d", &doc) == 1 && doc != 0) {
+					if (count == cap) {
+						cap *= 2;
+						int *grown = (int *)realloc(docs, cap * sizeof(int));
+						if (!grown) {
+							perror("realloc");
+							exit(EXIT_FAILURE);
+						}
+						docs = grown;
+					}
+					docs[count++] = doc;
+				}
+				while (getchar() != '\n');
+				Node **out = (Node **)malloc((count ? count : 1) * sizeof(Node *));
+				if (!out) {
+					perror("malloc");
+					exit(EXIT_FAILURE);
+				}
+				int found = 0;
+				if (congelado.n) {
+					found = frozen_find_batch(docs, count, out);
+				} else {
+					for (int i = 0; i < count; i++) found += (out[i] = find_node(root, docs[i])) != NULL;
+				}
+				for (int i = 0; i < count; i++)
+					if (!out[i]) printf("Documento %d no registrado.\n", docs[i]);
+				printf("Verificados: %d | Registrados: %d | No registrados: %d%s\n", count, found, count - found,
+					   congelado.n ? " (índice congelado)" : "");
+				free(out);
+				free(docs);
+				break;
+			}
+			case 16:
+			case 17: {
+				char path[256];
+				printf("Archivo: ");
+				if (scanf("%255s", path) != 1) {
+					printf("Entrada inválida.\n");
+					while (getchar() != '\n');
+					break;
+				}
+				if (opt == 16) {
+					import_csv(&root, path);
+				} else {
+					int n = export_csv(root, path);
+					if (n >= 0) printf("Exportados %d pasajeros a %s.\n", n, path);
+				}
+				break;
+			}
+			case 18:
 				running = 0;
 				break;
 			default:
@@ -263,4 +1205,4 @@ int main(void) {
 	printf("Saliendo. Memoria liberada.\n");
 	return 0;
 }
-
+#endif